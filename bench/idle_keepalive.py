@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""
+Measures how much CPU a blaster worker burns holding idle keep-alive
+connections: opens --connections keep-alive connections, sends one request
+on each, then leaves them idle and samples the CPU time of --pid (a
+worker, or a single-process blaster) for --duration seconds.
+
+    ulimit -n 20000
+    ./blaster --max-connections 0 5555 &
+    bench/idle_keepalive.py --pid $! --connections 10000
+
+The connections must stay open for the whole run, so pick a duration below
+blaster's --idle-timeout (5 seconds by default).
+"""
+import argparse
+import os
+import selectors
+import socket
+import sys
+import time
+
+REQUEST = b"GET / HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n"
+
+
+def cpu_seconds(pid):
+    with open("/proc/%d/stat" % pid) as stat:
+        # utime and stime are fields 14 and 15, counted after the ")" that
+        # ends the (possibly space-containing) command name.
+        fields = stat.read().rsplit(")", 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+
+def open_connections(host, port, count):
+    connections = []
+    selector = selectors.DefaultSelector()
+    for _ in range(count):
+        connection = socket.create_connection((host, port))
+        connection.sendall(REQUEST)
+        connection.setblocking(False)
+        selector.register(connection, selectors.EVENT_READ)
+        connections.append(connection)
+    # Wait for every response so the server is idle when we start measuring.
+    pending = len(connections)
+    deadline = time.monotonic() + 30
+    while pending and time.monotonic() < deadline:
+        for key, _ in selector.select(timeout=1):
+            key.fileobj.recv(4096)
+            selector.unregister(key.fileobj)
+            pending -= 1
+    selector.close()
+    if pending:
+        sys.exit("%d connection(s) never got a response" % pending)
+    return connections
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=5555)
+    parser.add_argument("--pid", type=int, required=True, help="blaster process to measure")
+    parser.add_argument("--connections", type=int, default=10000)
+    parser.add_argument("--duration", type=float, default=3.0)
+    arguments = parser.parse_args()
+
+    connections = open_connections(arguments.host, arguments.port, arguments.connections)
+    start_cpu = cpu_seconds(arguments.pid)
+    start = time.monotonic()
+    time.sleep(arguments.duration)
+    used = cpu_seconds(arguments.pid) - start_cpu
+    elapsed = time.monotonic() - start
+    print("%d idle keep-alive connections: %.2f CPU seconds in %.2f s (%.1f%% of a core)"
+          % (len(connections), used, elapsed, 100 * used / elapsed))
+    for connection in connections:
+        connection.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,188 @@
+/*
+** Replays the requests in parser_corpus.h through http_parser_execute, fed
+** the way a socket might hand them over, and times http_parser_parse_url on
+** their URLs. Reports ns per request and bytes/s for every combination.
+**
+**     make bench-parser
+**     bin/bench/parser_bench 0.5
+**
+** The optional argument is the number of seconds spent on each combination.
+** Every request is read in one go ("whole") and split at boundaries that
+** are awkward for the parser:
+**   bytes   one byte per read
+**   crlf    between every CR and its LF
+**   delims  just before every ':', ' ' and CR, so each token runs to the
+**           end of a read
+**   odd     every 7 bytes, out of step with the 16 and 32 byte scan kernels
+*/
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "http_parser.h"
+#include "parser_corpus.h"
+
+typedef enum BENCH_SPLIT {
+    SPLIT_WHOLE,
+    SPLIT_BYTES,
+    SPLIT_CRLF,
+    SPLIT_DELIMS,
+    SPLIT_ODD,
+    SPLITS,
+} BENCH_SPLIT;
+
+static const char *split_names[SPLITS] = {"whole", "bytes", "crlf", "delims", "odd"};
+
+static bool split_before(BENCH_SPLIT split, const char *text, size_t offset) {
+    switch (split) {
+        case SPLIT_WHOLE:
+            return false;
+        case SPLIT_BYTES:
+            return true;
+        case SPLIT_CRLF:
+            return text[offset] == '\n' && text[offset - 1] == '\r';
+        case SPLIT_DELIMS:
+            return text[offset] == ':' || text[offset] == ' ' || text[offset] == '\r';
+        case SPLIT_ODD:
+            return offset % 7 == 0;
+        default:
+            return false;
+    }
+}
+
+// Read lengths for text split one way, ending in a 0.
+static size_t *split_reads(BENCH_SPLIT split, const char *text, size_t length) {
+    size_t *reads = calloc(length + 1, sizeof(size_t));
+    size_t count = 0;
+    size_t start = 0;
+    for (size_t offset = 1; offset < length; offset++) {
+        if (split_before(split, text, offset)) {
+            reads[count++] = offset - start;
+            start = offset;
+        }
+    }
+    reads[count] = length - start;
+    return reads;
+}
+
+typedef struct BENCH_STATE {
+    int completed;
+    // The URL of the first request, gathered in a first, untimed pass for
+    // the parse_url benchmark
+    bool capture_url;
+    char url[256];
+    size_t url_length;
+} BENCH_STATE;
+
+static int on_url(http_parser *parser, const char *at, size_t length) {
+    BENCH_STATE *state = parser->data;
+    if (state->capture_url && state->completed == 0 && state->url_length + length < sizeof(state->url)) {
+        memcpy(state->url + state->url_length, at, length);
+        state->url_length += length;
+    }
+    return 0;
+}
+
+static int on_data(http_parser *parser, const char *at, size_t length) {
+    (void)parser;
+    (void)at;
+    (void)length;
+    return 0;
+}
+
+static int on_complete(http_parser *parser) {
+    ((BENCH_STATE *)parser->data)->completed += 1;
+    return 0;
+}
+
+static double elapsed_s(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Feeds text to a fresh parser in the given reads. Returns false if it did
+// not take all of it.
+static bool replay(const http_parser_settings *settings, BENCH_STATE *state, const char *text,
+                   const size_t *reads) {
+    http_parser parser;
+    parser.data = state;
+    http_parser_init(&parser, HTTP_REQUEST);
+    for (; *reads != 0; text += *reads, reads++) {
+        if (http_parser_execute(&parser, settings, text, *reads) != *reads) {
+            return parser.upgrade && reads[1] == 0;
+        }
+    }
+    return true;
+}
+
+static void print_result(const char *name, const char *split, size_t bytes, double taken,
+                         unsigned long operations, const char *unit) {
+    printf("%-18s %-7s %6zu bytes %10.1f MB/s %9.1f ns/%s\n", name, split, bytes,
+           (double)bytes * operations / taken / 1e6, taken * 1e9 / operations, unit);
+}
+
+int main(int argc, char **argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 0.2;
+    http_parser_settings settings;
+
+    http_parser_settings_init(&settings);
+    settings.on_url = on_url;
+    settings.on_header_field = on_data;
+    settings.on_header_value = on_data;
+    settings.on_body = on_data;
+    settings.on_message_complete = on_complete;
+
+    printf("kernel %s, request-only %d, strict %d\n", http_parser_scan_kernel(),
+           HTTP_PARSER_REQUEST_ONLY, HTTP_PARSER_STRICT);
+    for (size_t i = 0; i < PARSER_CORPUS_SIZE; i++) {
+        const PARSER_CORPUS_ENTRY *entry = &parser_corpus[i];
+        size_t length = strlen(entry->text);
+        BENCH_STATE state = {.capture_url = true};
+        size_t whole[2] = {length, 0};
+
+        replay(&settings, &state, entry->text, whole);
+        state.capture_url = false;
+        for (int split = 0; split < SPLITS; split++) {
+            size_t *reads = split_reads(split, entry->text, length);
+            unsigned long rounds = 0;
+            struct timespec start;
+            double taken;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            do {
+                for (int batch = 0; batch < 64; batch++) {
+                    state.completed = 0;
+                    if (!replay(&settings, &state, entry->text, reads) || state.completed != entry->requests) {
+                        fprintf(stderr, "%s split %s: %d of %d requests parsed\n", entry->name,
+                                split_names[split], state.completed, entry->requests);
+                        return 1;
+                    }
+                }
+                rounds += 64;
+            } while ((taken = elapsed_s(&start)) < seconds);
+            print_result(entry->name, split_names[split], length, taken, rounds * entry->requests, "request");
+            free(reads);
+        }
+
+        struct http_parser_url url;
+        unsigned long parsed = 0;
+        struct timespec start;
+        double taken;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do {
+            for (int batch = 0; batch < 1024; batch++) {
+                http_parser_url_init(&url);
+                if (http_parser_parse_url(state.url, state.url_length, 0, &url) != 0) {
+                    fprintf(stderr, "%s: cannot parse URL %.*s\n", entry->name, (int)state.url_length, state.url);
+                    return 1;
+                }
+            }
+            parsed += 1024;
+        } while ((taken = elapsed_s(&start)) < seconds);
+        print_result(entry->name, "url", state.url_length, taken, parsed, "url");
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*
+** Measures http_parser_execute throughput on the requests in
+** bench/parser_corpus.h and reports bytes/s, ns and (where the CPU's
+** counters can be read) instructions per request for the scan kernel in use.
+**
+**     make bench-scan
+**     HTTP_PARSER_SCAN=scalar bin/bench/parser_scan 2
+**
+** The optional argument is the number of seconds spent on each request.
+** HTTP_PARSER_SCAN picks the kernel (scalar, sse4.2, avx2); by default the
+** best one the CPU supports is used. make bench-variants runs it against the
+** generic parser and the request-only builds instead.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+#include "http_parser.h"
+#include "parser_corpus.h"
+
+static int on_data(http_parser *parser, const char *at, size_t length) {
+    (void)parser;
+    (void)at;
+    (void)length;
+    return 0;
+}
+
+static int on_complete(http_parser *parser) {
+    *(int *)parser->data += 1;
+    return 0;
+}
+
+// A counter of the instructions this process retires in user space, or -1
+// where perf events are not available (containers, most VMs).
+static int open_instruction_counter(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long read_counter(int counter) {
+    long long count = 0;
+    if (counter < 0 || read(counter, &count, sizeof(count)) != sizeof(count)) {
+        return -1;
+    }
+    return count;
+}
+
+static double elapsed_s(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    http_parser_settings settings;
+    http_parser parser;
+    int completed = 0;
+    int counter = open_instruction_counter();
+
+    http_parser_settings_init(&settings);
+    settings.on_url = on_data;
+    settings.on_header_field = on_data;
+    settings.on_header_value = on_data;
+    settings.on_body = on_data;
+    settings.on_message_complete = on_complete;
+    parser.data = &completed;
+
+    printf("kernel %s, request-only %d, strict %d, lenient headers %d\n", http_parser_scan_kernel(),
+           HTTP_PARSER_REQUEST_ONLY, HTTP_PARSER_STRICT, HTTP_PARSER_LENIENT_HEADERS);
+    for (size_t i = 0; i < PARSER_CORPUS_SIZE; i++) {
+        const PARSER_CORPUS_ENTRY *entry = &parser_corpus[i];
+        size_t length = strlen(entry->text);
+        unsigned long iterations = 0;
+        struct timespec start;
+        double taken;
+
+        completed = 0;
+        long long instructions = read_counter(counter);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do {
+            // check the clock every 1024 requests so it stays out of the numbers
+            for (int batch = 0; batch < 1024; batch++) {
+                http_parser_init(&parser, HTTP_REQUEST);
+                if (http_parser_execute(&parser, &settings, entry->text, length) != length) {
+                    fprintf(stderr, "%s: %s\n", entry->name,
+                            http_errno_description(HTTP_PARSER_ERRNO(&parser)));
+                    return 1;
+                }
+            }
+            iterations += 1024;
+        } while ((taken = elapsed_s(&start)) < seconds);
+        if (instructions >= 0) {
+            instructions = read_counter(counter) - instructions;
+        }
+
+        // a pipelined entry holds several requests
+        unsigned long parsed = iterations * entry->requests;
+        if ((unsigned long)completed != parsed) {
+            fprintf(stderr, "%s: %d of %lu requests completed\n", entry->name, completed, parsed);
+            return 1;
+        }
+        printf("%-17s %5zu bytes %10.1f MB/s %8.1f ns/request", entry->name, length,
+               (double)length * iterations / taken / 1e6, taken * 1e9 / parsed);
+        if (instructions >= 0) {
+            printf(" %8.1f instructions/request", (double)instructions / parsed);
+        }
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""
+Measures the CPU a blaster worker spends per POST when the route ignores
+the body: sends --requests pipelined "POST /" requests with a --body-size
+byte Content-Length body over one keep-alive connection, --depth at a time, and
+reports the CPU time of --pid (a worker, or a single-process blaster).
+
+    ./blaster --max-requests 0 5555 &
+    bench/post_bodies.py --pid $! --body-size 65536
+
+Run it against a build from before a change to the body path to see what
+the change saved; use a route that reads the body (--path /upload) to see
+what parsing the body would cost.
+"""
+import argparse
+import os
+import selectors
+import socket
+import sys
+import time
+
+
+def cpu_seconds(pid):
+    with open("/proc/%d/stat" % pid) as stat:
+        # utime and stime are fields 14 and 15, counted after the ")" that
+        # ends the (possibly space-containing) command name.
+        fields = stat.read().rsplit(")", 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+
+def run_connection(host, port, path, body, count, depth):
+    request = (b"POST " + path.encode() + b" HTTP/1.1\r\nHost: bench\r\n"
+               b"Content-Type: application/octet-stream\r\nContent-Length: "
+               + str(len(body)).encode() + b"\r\n\r\n" + body)
+    connection = socket.create_connection((host, port))
+    selector = selectors.DefaultSelector()
+    selector.register(connection, selectors.EVENT_READ)
+    sent = answered = 0
+    received = b""
+    while answered < count:
+        # Keep up to depth requests in flight.
+        batch = min(depth - (sent - answered), count - sent)
+        if batch > 0:
+            connection.sendall(request * batch)
+            sent += batch
+        selector.select(timeout=10)
+        chunk = connection.recv(1 << 16)
+        if not chunk:
+            sys.exit("connection closed after %d responses" % answered)
+        received += chunk
+        responses = received.count(b"HTTP/1.1 ")
+        if responses:
+            answered += responses
+            received = received[received.rfind(b"HTTP/1.1 ") + 9:]
+    selector.close()
+    connection.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=5555)
+    parser.add_argument("--pid", type=int, required=True, help="blaster process to measure")
+    parser.add_argument("--path", default="/")
+    parser.add_argument("--body-size", type=int, default=65536)
+    parser.add_argument("--requests", type=int, default=2000)
+    parser.add_argument("--depth", type=int, default=4, help="requests in flight per connection")
+    arguments = parser.parse_args()
+
+    body = b"x" * arguments.body_size
+    start_cpu = cpu_seconds(arguments.pid)
+    start = time.monotonic()
+    run_connection(arguments.host, arguments.port, arguments.path, body, arguments.requests, arguments.depth)
+    used = cpu_seconds(arguments.pid) - start_cpu
+    elapsed = time.monotonic() - start
+    megabytes = arguments.requests * arguments.body_size / 1e6
+    print("%d POST %s with %d byte bodies: %.2f CPU seconds in %.2f s, %.1f us/request, %.1f ms/MB"
+          % (arguments.requests, arguments.path, arguments.body_size, used, elapsed,
+             1e6 * used / arguments.requests, 1e3 * used / megabytes if megabytes else 0))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,444 @@
+/*
+** Fuzz target for http_parser_execute and http_parser_parse_url.
+**
+**     make fuzz-parser               (libFuzzer, needs clang)
+**     make fuzz-parser-standalone    (any compiler, no coverage guidance)
+**
+** The first byte of an input picks how it is parsed (split pattern, parser
+** type, header limit), the rest is what a client sent. Every input is parsed
+** twice: in one read and split into many. The parser is a state machine, so
+** both must fail with the same error or, when they succeed, consume the same
+** bytes and produce the same callbacks once adjacent pieces of a URL, name,
+** value or body are joined up. Any URL the parser hands over is then put
+** through http_parser_parse_url, whose fields must stay inside it. Both runs
+** are built with the sanitizers, which catch reads past the input.
+**
+** Built with -D PARSER_FUZZ_STANDALONE it gets its own main(): given files it
+** replays them, given --write-corpus DIR it writes the corpus in
+** bench/parser_corpus.h out as seeds, and given nothing it checks that every
+** method is recognized, then runs the corpus under every first byte plus a
+** fixed series of mutations of it.
+*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http_parser.h"
+#include "parser_corpus.h"
+
+// Inputs past this are skipped: longer ones find nothing new and run slowly.
+#define FUZZ_MAX_INPUT 65536
+
+typedef enum FUZZ_EVENT_KIND {
+    EVENT_MESSAGE_BEGIN,
+    EVENT_URL,
+    EVENT_STATUS,
+    EVENT_HEADER_FIELD,
+    EVENT_HEADER_VALUE,
+    EVENT_HEADERS_COMPLETE,
+    EVENT_BODY,
+    EVENT_MESSAGE_COMPLETE,
+    EVENT_CHUNK_HEADER,
+    EVENT_CHUNK_COMPLETE,
+} FUZZ_EVENT_KIND;
+
+typedef struct FUZZ_EVENT {
+    FUZZ_EVENT_KIND kind;
+    // Where the event's bytes start in FUZZ_TRACE.data, and how many
+    size_t offset;
+    size_t length;
+} FUZZ_EVENT;
+
+// The callbacks one parse made, with pieces of the same data joined.
+typedef struct FUZZ_TRACE {
+    FUZZ_EVENT *events;
+    size_t events_count;
+    size_t events_capacity;
+    char *data;
+    size_t data_length;
+    size_t data_capacity;
+} FUZZ_TRACE;
+
+static void trace_grow(void **buffer, size_t *capacity, size_t needed, size_t size) {
+    if (needed <= *capacity) {
+        return;
+    }
+    size_t grown = *capacity ? *capacity * 2 : 64;
+    while (grown < needed) {
+        grown *= 2;
+    }
+    *buffer = realloc(*buffer, grown * size);
+    if (*buffer == NULL) {
+        abort();
+    }
+    *capacity = grown;
+}
+
+static void trace_add(FUZZ_TRACE *trace, FUZZ_EVENT_KIND kind, const void *at, size_t length, bool joins) {
+    trace_grow((void **)&trace->data, &trace->data_capacity, trace->data_length + length, 1);
+    if (length > 0) {
+        memcpy(trace->data + trace->data_length, at, length);
+    }
+    trace->data_length += length;
+    if (joins && trace->events_count > 0 && trace->events[trace->events_count - 1].kind == kind) {
+        trace->events[trace->events_count - 1].length += length;
+        return;
+    }
+    trace_grow((void **)&trace->events, &trace->events_capacity, trace->events_count + 1, sizeof(FUZZ_EVENT));
+    trace->events[trace->events_count++] = (FUZZ_EVENT){kind, trace->data_length - length, length};
+}
+
+static bool trace_equal(const FUZZ_TRACE *a, const FUZZ_TRACE *b) {
+    if (a->events_count != b->events_count || a->data_length != b->data_length) {
+        return false;
+    }
+    for (size_t i = 0; i < a->events_count; i++) {
+        if (a->events[i].kind != b->events[i].kind || a->events[i].length != b->events[i].length) {
+            return false;
+        }
+    }
+    return a->data_length == 0 || memcmp(a->data, b->data, a->data_length) == 0;
+}
+
+static void trace_free(FUZZ_TRACE *trace) {
+    free(trace->events);
+    free(trace->data);
+}
+
+#define FUZZ_ON_DATA(NAME, KIND) \
+    static int NAME(http_parser *parser, const char *at, size_t length) { \
+        trace_add(parser->data, KIND, at, length, true); \
+        return 0; \
+    }
+
+#define FUZZ_ON_NOTIFY(NAME, KIND) \
+    static int NAME(http_parser *parser) { \
+        trace_add(parser->data, KIND, NULL, 0, false); \
+        return 0; \
+    }
+
+FUZZ_ON_DATA(on_url, EVENT_URL)
+FUZZ_ON_DATA(on_status, EVENT_STATUS)
+FUZZ_ON_DATA(on_header_field, EVENT_HEADER_FIELD)
+FUZZ_ON_DATA(on_header_value, EVENT_HEADER_VALUE)
+FUZZ_ON_DATA(on_body, EVENT_BODY)
+FUZZ_ON_NOTIFY(on_message_begin, EVENT_MESSAGE_BEGIN)
+FUZZ_ON_NOTIFY(on_message_complete, EVENT_MESSAGE_COMPLETE)
+FUZZ_ON_NOTIFY(on_chunk_complete, EVENT_CHUNK_COMPLETE)
+
+// What the parser knows about a message by the end of its headers is part of
+// the trace too.
+static int on_headers_complete(http_parser *parser) {
+    uint32_t seen[] = {
+        parser->type, parser->method, parser->status_code, parser->http_major, parser->http_minor,
+        parser->flags, parser->upgrade, (uint32_t)http_should_keep_alive(parser),
+    };
+    trace_add(parser->data, EVENT_HEADERS_COMPLETE, seen, sizeof(seen), false);
+    return 0;
+}
+
+static int on_chunk_header(http_parser *parser) {
+    uint64_t length = parser->content_length;
+    trace_add(parser->data, EVENT_CHUNK_HEADER, &length, sizeof(length), false);
+    return 0;
+}
+
+static http_parser_settings settings = {
+    .on_message_begin = on_message_begin,
+    .on_url = on_url,
+    .on_status = on_status,
+    .on_header_field = on_header_field,
+    .on_header_value = on_header_value,
+    .on_headers_complete = on_headers_complete,
+    .on_body = on_body,
+    .on_message_complete = on_message_complete,
+    .on_chunk_header = on_chunk_header,
+    .on_chunk_complete = on_chunk_complete,
+};
+
+typedef struct FUZZ_RUN {
+    FUZZ_TRACE trace;
+    size_t consumed;
+    enum http_errno error;
+} FUZZ_RUN;
+
+static void fuzz_fail(const char *what, const uint8_t *input, size_t length) {
+    fprintf(stderr, "parser_fuzz: %s on %zu byte input, first byte 0x%02x:\n%.*s\n", what, length,
+            input[0], (int)(length - 1), (const char *)input + 1);
+    abort();
+}
+
+// Length of the next read when input is split by the pattern in seed.
+static size_t next_read(uint8_t seed, const uint8_t *data, size_t offset, size_t length, uint32_t *random) {
+    size_t read = 1;
+    switch (seed & 3) {
+        case 0:
+            // fixed stride, 1 to 8 bytes
+            read = ((seed >> 2) & 7) + 1;
+            break;
+        case 1:
+            // up to the next delimiter, which starts the following read
+            while (offset + read < length && strchr(":; \t\r\n", data[offset + read]) == NULL) {
+                read++;
+            }
+            break;
+        case 2:
+            // pseudo-random, 1 to 64 bytes
+            *random = *random * 1103515245u + 12345u;
+            read = ((*random >> 16) & 63) + 1;
+            break;
+        case 3:
+            // one byte at a time
+            break;
+    }
+    return read < length - offset ? read : length - offset;
+}
+
+static void fuzz_parse(FUZZ_RUN *run, uint8_t seed, const uint8_t *data, size_t length, bool split) {
+    http_parser parser;
+#if HTTP_PARSER_REQUEST_ONLY
+    enum http_parser_type type = HTTP_REQUEST;
+#else
+    enum http_parser_type type = (enum http_parser_type)(((seed >> 5) & 3) % 3);
+#endif
+    uint32_t random = seed;
+
+    memset(run, 0, sizeof(*run));
+    http_parser_init(&parser, type);
+    parser.data = &run->trace;
+    if (seed & 0x80) {
+        // small enough for the corpus to run into
+        http_parser_set_max_header_size(&parser, 256);
+    }
+    if (!split) {
+        run->consumed = http_parser_execute(&parser, &settings, (const char *)data, length);
+    } else {
+        while (run->consumed < length) {
+            size_t read = next_read(seed, data, run->consumed, length, &random);
+            size_t parsed = http_parser_execute(&parser, &settings, (const char *)data + run->consumed, read);
+            run->consumed += parsed;
+            // what follows an upgrade is not HTTP, so the embedder stops
+            if (parsed != read || parser.upgrade) {
+                break;
+            }
+        }
+    }
+    run->error = HTTP_PARSER_ERRNO(&parser);
+}
+
+static void fuzz_parse_url(const uint8_t *input, size_t input_length, const char *url, size_t length, int is_connect) {
+    struct http_parser_url fields;
+    http_parser_url_init(&fields);
+    if (http_parser_parse_url(url, length, is_connect, &fields) != 0) {
+        return;
+    }
+    for (int field = 0; field < UF_MAX; field++) {
+        if ((fields.field_set & (1 << field)) &&
+                (size_t)fields.field_data[field].off + fields.field_data[field].len > length) {
+            fuzz_fail("URL field out of bounds", input, input_length);
+        }
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *input, size_t length) {
+    if (length < 1 || length > FUZZ_MAX_INPUT) {
+        return 0;
+    }
+    uint8_t seed = input[0];
+    const uint8_t *data = input + 1;
+    size_t data_length = length - 1;
+    FUZZ_RUN whole, split;
+
+    fuzz_parse(&whole, seed, data, data_length, false);
+    fuzz_parse(&split, seed, data, data_length, true);
+    if (whole.error != split.error) {
+        fuzz_fail("whole and split parses fail differently", input, length);
+    }
+    if (whole.error == HPE_OK) {
+        if (whole.consumed != split.consumed) {
+            fuzz_fail("whole and split parses consume different lengths", input, length);
+        }
+        if (!trace_equal(&whole.trace, &split.trace)) {
+            fuzz_fail("whole and split parses make different callbacks", input, length);
+        }
+    }
+
+    for (size_t i = 0; i < whole.trace.events_count; i++) {
+        const FUZZ_EVENT *event = &whole.trace.events[i];
+        if (event->kind == EVENT_URL) {
+            fuzz_parse_url(input, length, whole.trace.data + event->offset, event->length, 0);
+            fuzz_parse_url(input, length, whole.trace.data + event->offset, event->length, 1);
+        }
+    }
+    // and the raw input, which reaches states no URL from the parser does
+    fuzz_parse_url(input, length, (const char *)data, data_length, seed & 1);
+
+    trace_free(&whole.trace);
+    trace_free(&split.trace);
+    return 0;
+}
+
+#ifdef PARSER_FUZZ_STANDALONE
+
+// Runs one input from an exactly sized copy, so reads past it are caught.
+static void run_input(const uint8_t *input, size_t length) {
+    uint8_t *copy = malloc(length ? length : 1);
+    memcpy(copy, input, length);
+    LLVMFuzzerTestOneInput(copy, length);
+    free(copy);
+}
+
+static int replay_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return 1;
+    }
+    uint8_t *input = malloc(FUZZ_MAX_INPUT + 1);
+    size_t length = fread(input, 1, FUZZ_MAX_INPUT + 1, file);
+    fclose(file);
+    run_input(input, length);
+    free(input);
+    return 0;
+}
+
+static int write_corpus(const char *directory) {
+    for (size_t i = 0; i < PARSER_CORPUS_SIZE; i++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", directory, parser_corpus[i].name);
+        FILE *file = fopen(path, "wb");
+        if (file == NULL) {
+            perror(path);
+            return 1;
+        }
+        fputc(0, file);
+        fputs(parser_corpus[i].text, file);
+        fclose(file);
+    }
+    return 0;
+}
+
+static uint32_t mutation_random = 1;
+
+static uint32_t next_random(void) {
+    mutation_random = mutation_random * 1103515245u + 12345u;
+    return mutation_random >> 8;
+}
+
+// Changes input in place the way a fuzzer would, byte flips and all, and
+// returns its new length. Input has room for FUZZ_MAX_INPUT bytes.
+static size_t mutate(uint8_t *input, size_t length) {
+    static const char interesting[] = "\r\n:; \t\0/?#@[]%-0123456789abcdefGET HTTP/1.1";
+    int mutations = 1 + next_random() % 4;
+    for (int i = 0; i < mutations && length > 1; i++) {
+        size_t at = 1 + next_random() % (length - 1);
+        switch (next_random() % 6) {
+            case 0:
+                input[at] ^= 1 << (next_random() % 8);
+                break;
+            case 1:
+                input[at] = interesting[next_random() % (sizeof(interesting) - 1)];
+                break;
+            case 2:
+                if (length < FUZZ_MAX_INPUT) {
+                    memmove(input + at + 1, input + at, length - at);
+                    input[at] = interesting[next_random() % (sizeof(interesting) - 1)];
+                    length++;
+                }
+                break;
+            case 3:
+                memmove(input + at, input + at + 1, length - at - 1);
+                length--;
+                break;
+            case 4:
+                length = at;
+                break;
+            case 5: {
+                // repeat a piece, which makes long tokens and many headers
+                size_t piece = 1 + next_random() % (length - at);
+                size_t times = 1 + next_random() % 64;
+                for (size_t t = 0; t < times && length + piece <= FUZZ_MAX_INPUT; t++) {
+                    memmove(input + at + piece, input + at, length - at);
+                    length += piece;
+                }
+                break;
+            }
+        }
+    }
+    input[0] = next_random();
+    return length;
+}
+
+// Every method has to come out of a request line that arrives in one read,
+// which is the path that looks it up in the parser's method hash.
+static void check_methods(void) {
+    static const struct {
+        enum http_method method;
+        const char *name;
+    } methods[] = {
+#define XX(num, name, string) {HTTP_##name, #string},
+        HTTP_METHOD_MAP(XX)
+#undef XX
+    };
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        char line[64];
+        int length = snprintf(line, sizeof(line), "%s %s HTTP/1.1\r\n\r\n", methods[i].name,
+                              methods[i].method == HTTP_CONNECT ? "a:1" : "/");
+        http_parser parser;
+        http_parser_settings none;
+        memset(&none, 0, sizeof(none));
+        http_parser_init(&parser, HTTP_REQUEST);
+        http_parser_execute(&parser, &none, line, length);
+        if (HTTP_PARSER_ERRNO(&parser) != HPE_OK || parser.method != methods[i].method) {
+            fprintf(stderr, "parser_fuzz: method %s not recognized (%s)\n", methods[i].name,
+                    http_errno_name(HTTP_PARSER_ERRNO(&parser)));
+            abort();
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "--write-corpus") == 0) {
+        return write_corpus(argv[2]);
+    }
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            if (replay_file(argv[i]) != 0) {
+                return 1;
+            }
+        }
+        printf("%d inputs replayed\n", argc - 1);
+        return 0;
+    }
+
+    check_methods();
+    uint8_t *input = malloc(FUZZ_MAX_INPUT);
+    unsigned long runs = 0;
+    for (size_t i = 0; i < PARSER_CORPUS_SIZE; i++) {
+        size_t text_length = strlen(parser_corpus[i].text);
+        for (int seed = 0; seed < 256; seed++) {
+            input[0] = seed;
+            memcpy(input + 1, parser_corpus[i].text, text_length);
+            run_input(input, text_length + 1);
+            runs++;
+        }
+        // mutations pile up for a few rounds before starting over
+        size_t length = 0;
+        for (int round = 0; round < 2000; round++) {
+            if (round % 8 == 0) {
+                memcpy(input + 1, parser_corpus[i].text, text_length);
+                length = text_length + 1;
+            }
+            length = mutate(input, length);
+            run_input(input, length);
+            runs++;
+        }
+    }
+    free(input);
+    printf("%lu inputs run\n", runs);
+    return 0;
+}
+
+#endif
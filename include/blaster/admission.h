@@ -0,0 +1,26 @@
+#ifndef blaster_admission_h
+#define blaster_admission_h
+
+/*
+** Accept-side admission control.
+** Once the number of live connections reaches the high-water mark the accept
+** loop stops calling accept() and leaves new clients queued in the kernel's
+** listen backlog. Accepting resumes when handlers have closed enough
+** connections to get back down to the low-water mark.
+*/
+
+// A high_water of 0 disables admission control.
+void admission_init(int high_water, int low_water);
+
+/*
+** admission_wait()
+** Parks the calling coroutine while we are over the high-water mark, or
+** until the worker starts draining. Returns how many connections may be
+** accepted right now (INT_MAX when unlimited, 0 when draining).
+*/
+int admission_wait(void);
+
+void admission_connection_opened(void);
+void admission_connection_closed(void);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef blaster_body_sink_h
+#define blaster_body_sink_h
+
+#include <stddef.h>
+#include <blaster/buffer_pool.h>
+
+/*
+** Collects a request body for routes that want all of it at once.
+** Bodies up to the spill threshold are kept in a buffer from the worker's
+** pool. Past it, everything goes into an unlinked temp file instead, which
+** body_sink_finish() maps read-only, so a handler sees one contiguous body
+** either way while a connection never holds more than the threshold in
+** memory. Writing the file is plain blocking I/O; it mostly lands in the
+** page cache.
+*/
+
+typedef struct BLASTER_BODY_SINK {
+    // The body while it is under the threshold
+    BLASTER_BUFFER memory;
+    // The temp file once spilled, -1 before
+    int fd;
+    size_t length;
+    // The whole body after body_sink_finish()
+    const char *data;
+    // Length of the mapping of the temp file, 0 when not mapped
+    size_t mapped_length;
+} BLASTER_BODY_SINK;
+
+// Per worker: the spill threshold and the directory temp files go in.
+void body_sink_init(size_t threshold, const char *directory);
+
+// Readies an empty sink. Call before anything else, once per sink.
+void body_sink_reset(BLASTER_BODY_SINK *sink);
+
+// Appends a piece of the body. Returns 0, or -1 on failure (errno set).
+int body_sink_write(BLASTER_BODY_SINK *sink, const char *data, size_t length);
+
+/*
+** body_sink_finish(sink)
+** Makes sink->data point at the whole body, sink->length bytes (NULL for
+** an empty body). Returns 0, or -1 if the temp file cannot be mapped.
+*/
+int body_sink_finish(BLASTER_BODY_SINK *sink);
+
+// Frees whatever the sink holds and leaves it empty, ready for reuse.
+void body_sink_release(BLASTER_BODY_SINK *sink);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef blaster_buffer_pool_h
+#define blaster_buffer_pool_h
+
+#include <stddef.h>
+
+/*
+** Per-worker pool of connection read buffers.
+** Buffers of BUFFER_POOL_BUFFER_SIZE bytes are carved out of slabs and kept
+** on a free list, so handing one to a connection is a pointer pop and
+** nothing is zeroed. A request that does not fit gets its buffer grown (by
+** doubling, with malloc) up to the configured maximum; grown buffers go back
+** to malloc rather than the pool when released.
+*/
+
+#define BUFFER_POOL_BUFFER_SIZE 4096
+// Buffers per slab malloc()
+#define BUFFER_POOL_SLAB_BUFFERS 64
+
+typedef struct BLASTER_BUFFER {
+    // NULL while the connection holds no buffer
+    char *data;
+    size_t capacity;
+} BLASTER_BUFFER;
+
+// max_size is the most a single buffer may grow to.
+void buffer_pool_init(size_t max_size);
+
+/*
+** buffer_acquire(buffer)
+** Hands buffer a pooled buffer. Returns 0, or -1 if we are out of memory.
+*/
+int buffer_acquire(BLASTER_BUFFER *buffer);
+
+/*
+** buffer_grow(buffer, used)
+** Doubles the capacity of buffer, keeping its first used bytes. Returns 0,
+** or -1 if it is already at the maximum size or we are out of memory, in
+** which case buffer is left as it was.
+*/
+int buffer_grow(BLASTER_BUFFER *buffer, size_t used);
+
+// Gives the buffer back (a no-op for a buffer that holds nothing).
+void buffer_release(BLASTER_BUFFER *buffer);
+
+#endif
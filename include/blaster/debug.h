@@ -0,0 +1,13 @@
+#ifndef blaster_debug_h
+#define blaster_debug_h
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#ifdef DEBUG
+#define DEBUG_PRINTF(...) do{ fprintf( stderr, __VA_ARGS__ ); } while( false )
+#else
+#define DEBUG_PRINTF(...) do{ } while ( false )
+#endif
+
+#endif
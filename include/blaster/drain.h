@@ -0,0 +1,48 @@
+#ifndef blaster_drain_h
+#define blaster_drain_h
+
+#include <stdbool.h>
+
+/*
+** Graceful shutdown of a worker.
+** SIGQUIT asks a worker to drain: stop accepting, answer whatever requests
+** are in flight with Connection: close, and exit once its connections are
+** gone (or the drain timeout passes). The master uses it to retire the old
+** generation of workers during an upgrade.
+*/
+
+// Installs the SIGQUIT handler and unblocks SIGQUIT for the calling thread.
+// Safe to call from every worker thread; the drain state is shared by the
+// whole process.
+void drain_init(void);
+
+// Becomes (and stays) readable once a drain has been requested, so the
+// accept loop can wait on it next to the listener.
+int drain_fd(void);
+
+bool draining(void);
+
+// A connection parked between keep-alive requests. Links in its worker's
+// list, which a drain walks to close the connections nobody is using.
+typedef struct BLASTER_IDLE {
+    struct BLASTER_IDLE *next;
+    struct BLASTER_IDLE *prev;
+    int fd;
+} BLASTER_IDLE;
+
+// Around the wait of an idle connection: while it is in the list a drain
+// shuts fd down, which wakes the wait with EOF.
+void drain_idle_begin(BLASTER_IDLE *idle, int fd);
+void drain_idle_end(BLASTER_IDLE *idle);
+
+// Shuts down the calling worker's idle connections. Returns how many.
+int drain_close_idle(void);
+
+/*
+** drain_connections(timeout_ms)
+** Sleeps until the worker has no live connections left or timeout_ms has
+** passed. Returns the number of connections still open.
+*/
+int drain_connections(int64_t timeout_ms);
+
+#endif
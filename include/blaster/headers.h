@@ -0,0 +1,91 @@
+#ifndef blaster_headers_h
+#define blaster_headers_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+** A request's headers, captured while the parser goes over them. Each entry
+** is a name and a value as offsets into the connection's read buffer (which
+** may move while the request is still coming in) plus a hash of the name,
+** so nothing is copied or allocated. Headers with a well-known name also get
+** a fixed slot, making headers_get() a single array index.
+*/
+
+// Most headers kept per request; a request with more gets a 431.
+#define HEADERS_MAX 64
+
+typedef enum BLASTER_HEADER_NAME {
+    HEADER_HOST,
+    HEADER_CONTENT_TYPE,
+    HEADER_CONTENT_LENGTH,
+    HEADER_ACCEPT,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_AUTHORIZATION,
+    HEADER_COOKIE,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_RANGE,
+    HEADER_USER_AGENT,
+    HEADER_X_FORWARDED_FOR,
+    HEADERS_WELL_KNOWN,
+} BLASTER_HEADER_NAME;
+
+typedef struct BLASTER_HEADER {
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint32_t value_offset;
+    uint32_t value_length;
+    // FNV-1a of the lower-cased name
+    uint32_t hash;
+} BLASTER_HEADER;
+
+typedef struct BLASTER_HEADERS {
+    uint32_t count;
+    // The last piece the parser handed us was part of a name
+    bool in_name;
+    // Set when a request had more than HEADERS_MAX headers
+    bool full;
+    // 1 + the index of the first header with each well-known name, 0 if absent
+    uint8_t well_known[HEADERS_WELL_KNOWN];
+    BLASTER_HEADER entries[HEADERS_MAX];
+} BLASTER_HEADERS;
+
+// Hashes the well-known names. Call once before any worker starts.
+void headers_init(void);
+
+// Empties the table for the next request.
+void headers_reset(BLASTER_HEADERS *headers);
+
+/*
+** headers_add_name(headers, offset, length)
+** headers_add_value(headers, buffer, offset, length)
+** Record the pieces of names and values as the parser's on_header_field and
+** on_header_value callbacks get them: offset is where the piece starts in
+** the read buffer. A piece that follows a piece of the same kind extends
+** it, so a name or value split across reads still ends up as one entry.
+** headers_add_name() returns -1 (and sets full) once the table is full.
+*/
+int headers_add_name(BLASTER_HEADERS *headers, size_t offset, size_t length);
+void headers_add_value(BLASTER_HEADERS *headers, const char *buffer, size_t offset, size_t length);
+
+// The first header with a well-known name, or NULL.
+static inline const BLASTER_HEADER *headers_get(const BLASTER_HEADERS *headers, BLASTER_HEADER_NAME name) {
+    return headers->well_known[name] ? &headers->entries[headers->well_known[name] - 1] : NULL;
+}
+
+// The first header called name (any case), or NULL.
+const BLASTER_HEADER *headers_find(const BLASTER_HEADERS *headers, const char *buffer,
+    const char *name, size_t name_length);
+
+// Offset in the buffer just past the last header value, 0 with no headers.
+static inline size_t headers_end(const BLASTER_HEADERS *headers) {
+    if (headers->count == 0) {
+        return 0;
+    }
+    const BLASTER_HEADER *last = &headers->entries[headers->count - 1];
+    return (size_t)last->value_offset + last->value_length;
+}
+
+#endif
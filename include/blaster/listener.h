@@ -0,0 +1,73 @@
+#ifndef blaster_listener_h
+#define blaster_listener_h
+
+#include <libmill.h>
+#include <stdbool.h>
+
+typedef struct BLASTER_LISTENER_OPTIONS {
+    int backlog;
+    // Several sockets (one per worker) bound to the same port, with the
+    // kernel spreading connections across them
+    bool reuseport;
+    // TCP_DEFER_ACCEPT: only hand us connections once they have data, giving
+    // up on (or, after the timeout, passing on) ones that stay silent this
+    // many seconds. 0 disables.
+    int defer_accept_s;
+    // TCP_FASTOPEN: queue length for connections whose request arrives in
+    // the SYN. 0 disables.
+    int fastopen_queue;
+} BLASTER_LISTENER_OPTIONS;
+
+/*
+** listener_open(address, options)
+** Creates a non-blocking TCP listening socket on address, configured as
+** listener_configure() does. Returns the file descriptor, or -1 with errno
+** set.
+*/
+int listener_open(ipaddr address, const BLASTER_LISTENER_OPTIONS *options);
+
+/*
+** listener_configure(fd, options)
+** Applies the per-listener TCP options and (re)starts listening with the
+** configured backlog. Also used on sockets inherited during an upgrade,
+** whose options may have changed. Returns 0, or -1 with errno set.
+*/
+int listener_configure(int fd, const BLASTER_LISTENER_OPTIONS *options);
+
+/*
+** listener_inspect_accepted(fd, options)
+** Counts what a freshly accepted connection brought with it: request bytes
+** already waiting, and whether they came in the SYN (TCP Fast Open). Only
+** does the extra syscalls when the listener has one of those options on.
+*/
+void listener_inspect_accepted(int fd, const BLASTER_LISTENER_OPTIONS *options);
+
+/*
+** listener_attach_cpu_steering(fd, group_size)
+** Attaches a classic BPF program to the reuseport group fd belongs to that
+** selects socket (receiving CPU % group_size). Sockets in a group are indexed
+** in the order they were bound, so the Nth listener opened gets the
+** connections that arrived on CPU N. Returns 0, or -1 with errno set.
+*/
+int listener_attach_cpu_steering(int fd, int group_size);
+
+/*
+** listener_accept_batch(fd, client_fds, max_batch)
+** Accepts up to max_batch pending connections from the listener fd without
+** ever waiting; the caller is expected to fdwait() for readability first.
+** Accepted sockets are non-blocking. Returns the number of connections
+** stored in client_fds; when that is less than max_batch errno says why we
+** stopped (EAGAIN means the backlog was drained).
+*/
+int listener_accept_batch(int fd, int client_fds[], int max_batch);
+
+/*
+** listener_wait_set(fd, wake_fd)
+** libmill can only fdwait() on one descriptor at a time, so this returns an
+** epoll descriptor that becomes readable when either the listener has
+** connections pending or wake_fd is readable. Returns -1 with errno set on
+** failure.
+*/
+int listener_wait_set(int fd, int wake_fd);
+
+#endif
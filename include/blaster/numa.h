@@ -0,0 +1,27 @@
+#ifndef blaster_numa_h
+#define blaster_numa_h
+
+#include <blaster/options.h>
+
+/*
+** NUMA-aware worker placement.
+** numa_plan() reads the node topology from sysfs and decides, for every
+** worker, the CPU it is pinned to and the node its memory comes from:
+**   - with --cpus or --cpu-steering the CPUs are already decided, and each
+**     worker simply gets the node its CPU belongs to;
+**   - otherwise CPUs are dealt out round-robin across nodes so consecutive
+**     workers land on different nodes, starting with the node of the NIC
+**     given by --numa-nic so it is never the one left short.
+** Each worker then calls numa_bind_memory() before it allocates its coroutine
+** stacks and buffers.
+*/
+
+// Fills in options->cpus/cpu_nodes and prints the resulting layout.
+// Returns 0, or -1 if the topology could not be read.
+int numa_plan(BLASTER_OPTIONS *options);
+
+// Makes node the preferred node for the calling thread's allocations.
+// Returns 0, or -1 with errno set.
+int numa_bind_memory(int node);
+
+#endif
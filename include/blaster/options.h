@@ -0,0 +1,109 @@
+#ifndef blaster_options_h
+#define blaster_options_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <blaster/listener.h>
+
+// Everything that can be tuned from the command line lives here so that
+// main() (and every forked worker) reads one struct instead of argv.
+typedef struct BLASTER_OPTIONS {
+    int port;
+    int num_processes;
+    // Alternative to num_processes: one process running this many threads,
+    // each with its own libmill scheduler, listener and accept loop.
+    int num_threads;
+    // Give every worker its own SO_REUSEPORT listener instead of sharing one
+    // accept queue between all of them.
+    bool reuseport;
+    // Attach a classic BPF program to the reuseport group that picks the
+    // listener by the CPU that received the packet, and pin worker N to CPU N.
+    // Implies reuseport.
+    bool cpu_steering;
+    // Most connections accepted per listener wakeup before going back to the
+    // scheduler so the handlers we just spawned get to run.
+    int accept_batch;
+    // backlog, reuseport, TCP_DEFER_ACCEPT and TCP_FASTOPEN for every
+    // listener (reuseport is kept in sync with the flag above)
+    BLASTER_LISTENER_OPTIONS listener;
+    // Stop accepting at max_connections live connections and start again at
+    // resume_connections. 0 means no limit.
+    int max_connections;
+    int resume_connections;
+    // Requests served on one keep-alive connection before we close it.
+    // 0 means no limit.
+    int max_requests;
+    // Most a connection's read buffer may grow to for one request's headers
+    size_t max_buffer_size;
+    // Most bytes of request line and headers the parser accepts per request
+    uint32_t max_header_size;
+    // Connection timeouts: receiving a request's headers, its body, sending
+    // the response and waiting for the next keep-alive request
+    int64_t header_timeout_ms;
+    int64_t body_timeout_ms;
+    int64_t idle_timeout_ms;
+    int64_t send_timeout_ms;
+    // Slowloris defense: bytes per second a client must keep up while
+    // sending headers or a body, once the grace period is over. 0 is off.
+    int min_data_rate;
+    int64_t min_data_rate_grace_ms;
+    // Bodies collected in memory for a route up to spill_threshold bytes
+    // and in an unlinked temp file in spill_directory beyond that
+    size_t spill_threshold;
+    const char *spill_directory;
+    // Run a master process that restarts workers that die. Always on when
+    // there is more than one worker.
+    bool supervise;
+    // CPUs to pin workers to, worker N getting cpus[N % num_cpus]. Empty
+    // means workers are not pinned (except by --cpu-steering, which pins
+    // worker N to CPU N).
+    int *cpus;
+    int num_cpus;
+    // With --numa: the node each entry of cpus belongs to, which is where
+    // that worker's memory comes from. NULL otherwise.
+    int *cpu_nodes;
+    bool numa;
+    // Network interface whose NUMA node gets workers first
+    const char *numa_nic;
+    // goprepare() arguments: coroutines preallocated per worker, the stack
+    // size every coroutine gets and the largest channel value size
+    int coroutines;
+    size_t stack_size;
+    size_t value_size;
+    // Measure how much of its stack each connection coroutine really uses
+    bool calibrate_stacks;
+    // Load shedding: sojourn time target (0 disables) and CoDel interval
+    int64_t shed_target_ms;
+    int64_t shed_interval_ms;
+    // How long a draining worker waits for its connections before exiting
+    int64_t drain_timeout_ms;
+    // Our own argv, re-exec'd for an upgrade
+    char **args;
+} BLASTER_OPTIONS;
+
+// Workers are processes, or threads with --threads.
+static inline int options_num_workers(const BLASTER_OPTIONS *options) {
+    return options->num_threads > 1 ? options->num_threads : options->num_processes;
+}
+
+/*
+** parse_options(arg_count, args, options)
+** Fills in options from the defaults and then the command line. Usage is
+**     blaster [flags] [port [num_processes]]
+** to stay compatible with the original positional arguments.
+** Returns 0 on success, -1 if the caller should exit cleanly (--help) and
+** a positive exit code if the arguments were bad.
+*/
+int parse_options(int arg_count, char* args[], BLASTER_OPTIONS *options);
+void print_usage(FILE *stream, const char *program);
+
+/*
+** parse_cpu_list(list, cpus, num_cpus)
+** Parses a list in the kernel's cpulist format ("0-3,8,10-11") into a
+** malloc()ed array. Returns 0, or -1 if the list is malformed.
+*/
+int parse_cpu_list(const char *list, int **cpus, int *num_cpus);
+
+#endif
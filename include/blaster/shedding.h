@@ -0,0 +1,25 @@
+#ifndef blaster_shedding_h
+#define blaster_shedding_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+** Latency-driven load shedding, after CoDel.
+** The signal is the sojourn time of a new connection: how long it took from
+** accept() until we got around to parsing its first request. While the
+** sojourn stays under target we serve everything. Once it has been above
+** target for a whole interval we start shedding: new connections get a
+** canned 503 instead of a trip through the router, one at a time, at a rate
+** that grows with the square root of how many we have shed since the
+** latency went bad. The first sample back under target stops it.
+*/
+
+// A target_ms of 0 disables shedding.
+void shedding_init(int64_t target_ms, int64_t interval_ms);
+
+// Records the sojourn time of a new connection and says whether to answer
+// it with a 503.
+bool shedding_should_shed(int64_t sojourn_ms);
+
+#endif
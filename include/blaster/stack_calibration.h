@@ -0,0 +1,34 @@
+#ifndef blaster_stack_calibration_h
+#define blaster_stack_calibration_h
+
+#include <stddef.h>
+
+/*
+** Stack calibration.
+** goprepare() hands every coroutine a fixed-size stack, and the only way to
+** size it well is to know how deep handle_request really gets. In
+** calibration mode each connection coroutine paints the unused part of its
+** stack with a pattern before serving, and afterwards scans for the deepest
+** byte that was overwritten. The largest depth seen is the high-water mark.
+*/
+
+// Room left unpainted at the top of the stack for libmill's own frames and
+// ours above the point where painting starts.
+#define STACK_CALIBRATION_RESERVE 8192
+
+// Fills the paint_bytes below base (the address of a local in the caller)
+// with the paint pattern, leaving the first bytes right below base alone for
+// this function's own frame.
+void stack_paint(volatile char *base, size_t paint_bytes);
+
+// Returns how many bytes below base were used since stack_paint().
+size_t stack_measure(volatile char *base, size_t paint_bytes);
+
+// Folds a measurement into the worker's stats.
+void stack_record(size_t used_bytes);
+
+// A stack size with headroom over the high-water mark seen so far, or 0
+// before anything was measured.
+size_t stack_suggested_size(void);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef blaster_stats_h
+#define blaster_stats_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Per-worker counters. Workers are processes or, with --threads, threads
+// that each get their own copy, so there is no sharing (or locking)
+// involved; /stats reports the worker that answered.
+typedef struct BLASTER_STATS {
+    // Times the accept loop woke up because the listener was readable
+    uint64_t accept_wakeups;
+    // Wakeups that found nothing to accept (another worker got there first)
+    uint64_t accept_empty_wakeups;
+    uint64_t accepted;
+    // Largest number of connections drained in a single wakeup
+    uint64_t accept_max_batch;
+    // handle_request coroutines currently holding a connection
+    uint64_t live_connections;
+    // Times the accept loop stopped accepting at the high-water mark
+    uint64_t admission_pauses;
+    // Deepest connection coroutine stack use seen with --calibrate-stacks,
+    // and how many connections were measured
+    uint64_t stack_high_water;
+    uint64_t stack_samples;
+    // Load shedding: requests answered with a canned 503, whether we are
+    // shedding right now and the last accept-to-parse time sampled
+    uint64_t shed_requests;
+    uint64_t shedding;
+    int64_t sojourn_last_ms;
+    // Listener options at work: connections that had request bytes waiting
+    // when accepted, ones whose request came in the SYN (TCP Fast Open),
+    // and ones that closed without ever sending a byte -- the connections
+    // TCP_DEFER_ACCEPT keeps away from us
+    uint64_t accepted_with_data;
+    uint64_t accepted_fastopen;
+    uint64_t connections_empty;
+    // Requests that arrived behind another one in the same read (HTTP
+    // pipelining) and were answered in the same flush
+    uint64_t requests_pipelined;
+    // Read buffers: how many the pool has carved out of slabs, how many
+    // connections hold one right now and how often one had to grow past the
+    // pooled size for a large request
+    uint64_t buffers_pooled;
+    uint64_t buffers_in_use;
+    uint64_t buffers_grown;
+    // Connections we closed on a client, by reason: a phase timing out, or
+    // headers or a body arriving under --min-data-rate. Idle keep-alive
+    // connections timing out are counted separately, that is no misbehavior.
+    uint64_t drops_header_timeout;
+    uint64_t drops_body_timeout;
+    uint64_t drops_send_timeout;
+    uint64_t drops_slow_headers;
+    uint64_t drops_slow_body;
+    uint64_t idle_timeouts;
+    // Request bodies that went past --spill-threshold into a temp file
+    uint64_t bodies_spilled;
+    // Content-Length bodies skipped without parsing because their route
+    // does not read bodies, and how many bytes that was
+    uint64_t bodies_skipped;
+    uint64_t body_bytes_skipped;
+} BLASTER_STATS;
+
+extern _Thread_local BLASTER_STATS blaster_stats;
+
+/*
+** stats_format(buf, buf_length)
+** Writes the counters as "name value\n" lines. Returns the number of bytes
+** written (snprintf semantics, truncated output is never longer than buf).
+*/
+size_t stats_format(char *buf, size_t buf_length);
+
+#endif
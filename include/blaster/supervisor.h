@@ -0,0 +1,50 @@
+#ifndef blaster_supervisor_h
+#define blaster_supervisor_h
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <blaster/options.h>
+
+// A worker that exits within this long of starting is considered to be
+// crash-looping, and its next respawn is delayed twice as long as the last.
+#define WORKER_STABLE_MS 10000
+#define RESPAWN_BACKOFF_MIN_MS 10
+#define RESPAWN_BACKOFF_MAX_MS 5000
+
+typedef struct BLASTER_WORKER {
+    int index;
+    pid_t pid; // 0 while waiting to be respawned
+    int cpu; // -1 when not pinned
+    int listen_fd;
+    int restarts;
+    int64_t started_at;
+    int64_t respawn_at;
+    int64_t backoff_ms;
+    int last_status; // waitpid() status of the last exit, -1 if none yet
+} BLASTER_WORKER;
+
+// What every worker process runs. It is not expected to return while
+// serving; its return value becomes the worker's exit status.
+typedef int (*worker_main_fn)(const BLASTER_OPTIONS *options, int worker_index, int listen_fd);
+
+/*
+** supervise(options, listeners, num_listeners, worker_main)
+** Turns the calling process into the master: it forks one worker per
+** options->num_processes, pins each to its CPU from options->cpus, and
+** restarts workers that die (with backoff while they keep dying).
+** The master keeps every listener open so a worker that is being restarted
+** doesn't take its reuseport socket, or the clients queued on it, down too.
+** SIGUSR1 prints a status line per worker; SIGTERM/SIGINT stop the workers
+** and return; SIGQUIT drains them first. SIGUSR2 hands the listeners to a
+** freshly exec'd generation and then drains this one (see upgrade.h).
+*/
+int supervise(const BLASTER_OPTIONS *options, const int listeners[], int num_listeners, worker_main_fn worker_main);
+
+// Called by a worker once it is about to start accepting. The master waits
+// for every worker to check in before reporting a new generation ready.
+void supervisor_worker_ready(void);
+
+// Pins the calling process to cpu. Returns 0, or -1 with errno set.
+int pin_to_cpu(int cpu);
+
+#endif
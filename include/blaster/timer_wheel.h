@@ -0,0 +1,45 @@
+#ifndef blaster_timer_wheel_h
+#define blaster_timer_wheel_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+** Per-worker hierarchical timer wheel for connection timeouts.
+** Four levels of 64 slots; level 0 has a slot per TIMER_WHEEL_TICK_MS tick
+** and each level above covers 64 slots of the one below, cascading down as
+** its time comes. Arming, re-arming and cancelling a timer are O(1) list
+** operations that never read the clock, and a tick only touches the timers
+** that are due, however many connections there are.
+**
+** A timer that expires shuts its fd down, which wakes a coroutine parked
+** in fdwait() (or tcpsend()/tcpflush()) on it; timer->expired tells the
+** owner why the connection ended.
+*/
+
+#define TIMER_WHEEL_TICK_MS 100
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+typedef struct BLASTER_TIMER {
+    // Links in a wheel slot, NULL while not armed
+    struct BLASTER_TIMER *next;
+    struct BLASTER_TIMER *prev;
+    uint64_t expires_tick;
+    int fd;
+    bool expired;
+} BLASTER_TIMER;
+
+// Starts the worker's wheel and the coroutine that turns it.
+void timer_wheel_init(void);
+
+/*
+** timer_arm(timer, fd, timeout_ms)
+** (Re-)arms timer to shut fd down timeout_ms from now, rounded up to a
+** tick. A timeout_ms of 0 or less just cancels it.
+*/
+void timer_arm(BLASTER_TIMER *timer, int fd, int64_t timeout_ms);
+void timer_cancel(BLASTER_TIMER *timer);
+
+#endif
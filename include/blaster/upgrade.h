@@ -0,0 +1,52 @@
+#ifndef blaster_upgrade_h
+#define blaster_upgrade_h
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+** Zero-downtime binary upgrade.
+** On SIGUSR2 the master forks and execs the (possibly replaced) blaster
+** binary with the same arguments and hands it the listening sockets over a
+** Unix socket with SCM_RIGHTS. The new master starts its workers on those
+** very sockets, so nothing queued on them is lost, and reports back once
+** they are ready; only then does the old master drain its own workers and
+** exit.
+*/
+
+// How long the old generation waits for the new one to report ready.
+#define UPGRADE_READY_TIMEOUT_MS 10000
+
+// Environment variable telling the new generation which fd to talk on.
+#define UPGRADE_FD_ENV "BLASTER_UPGRADE_FD"
+
+/*
+** upgrade_inherit_listeners(listeners, num_listeners)
+** Called by every starting master. Returns 0 when this is not an upgrade,
+** 1 when listeners were filled in from the previous generation and -1 if an
+** upgrade was in progress but the listeners could not be taken over (for
+** example because the new command line asks for a different number).
+*/
+int upgrade_inherit_listeners(int listeners[], int num_listeners);
+
+// Whether we are an upgrade that still owes the previous generation a ready
+// notification.
+bool upgrade_pending(void);
+
+// Tells the previous generation that our workers are serving. No-op when
+// this is not an upgrade.
+void upgrade_ready(void);
+
+/*
+** upgrade_start(args, listeners, num_listeners)
+** Starts the next generation and waits for it to report ready. Returns the
+** new master's pid, or -1 if it failed to take over; in that case the
+** caller simply keeps serving.
+*/
+pid_t upgrade_start(char *const args[], const int listeners[], int num_listeners);
+
+// For a process without a master (single worker, --threads): SIGUSR2 only
+// logs that upgrades need --supervise, instead of killing the server.
+void upgrade_refuse(void);
+
+#endif
@@ -53,6 +53,22 @@ typedef unsigned __int64 uint64_t;
 # define HTTP_PARSER_STRICT 1
 #endif
 
+/* Compile with -DHTTP_PARSER_REQUEST_ONLY=1 to leave response parsing out
+ * of http_parser_execute() altogether. http_parser_init() then only takes
+ * HTTP_REQUEST; a parser of any other type starts out in an error state.
+ */
+#ifndef HTTP_PARSER_REQUEST_ONLY
+# define HTTP_PARSER_REQUEST_ONLY 0
+#endif
+
+/* Compile with -DHTTP_PARSER_LENIENT_HEADERS=0 (or 1) to decide whether
+ * header values are checked for invalid characters at compile time,
+ * ignoring lenient_http_headers. The default, -1, follows the flag.
+ */
+#ifndef HTTP_PARSER_LENIENT_HEADERS
+# define HTTP_PARSER_LENIENT_HEADERS -1
+#endif
+
 /* Maximium header size allowed. If the macro is not defined
  * before including this header then the default is used. To
  * change the maximum header size, define the macro in the build
@@ -224,6 +240,7 @@ struct http_parser {
   unsigned int lenient_http_headers : 1;
 
   uint32_t nread;          /* # bytes read in various scenarios */
+  uint32_t max_header_size; /* 0 = HTTP_MAX_HEADER_SIZE */
   uint64_t content_length; /* # bytes in body (0 if no Content-Length header) */
 
   /** READ-ONLY **/
@@ -307,6 +324,12 @@ unsigned long http_parser_version(void);
 void http_parser_init(http_parser *parser, enum http_parser_type type);
 
 
+/* Limit the total size of the headers (including the start line) to size
+ * bytes instead of HTTP_MAX_HEADER_SIZE. http_parser_init() resets the
+ * limit, so set it after every init.
+ */
+void http_parser_set_max_header_size(http_parser *parser, uint32_t size);
+
 /* Initialize http_parser_settings members to 0
  */
 void http_parser_settings_init(http_parser_settings *settings);
@@ -337,6 +360,9 @@ const char *http_errno_name(enum http_errno err);
 /* Return a string description of the given error */
 const char *http_errno_description(enum http_errno err);
 
+/* Name of the run-scanning kernel in use: "scalar", "sse4.2" or "avx2" */
+const char *http_parser_scan_kernel(void);
+
 /* Initialize all http_parser_url members to 0 */
 void http_parser_url_init(struct http_parser_url *u);
 
@@ -2,81 +2,205 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <sys/socket.h>
+#include <pthread.h>
 #include <contrib/http_parser.h>
+#include <blaster/admission.h>
+#include <blaster/body_sink.h>
+#include <blaster/buffer_pool.h>
+#include <blaster/debug.h>
+#include <blaster/drain.h>
+#include <blaster/headers.h>
+#include <blaster/listener.h>
+#include <blaster/numa.h>
+#include <blaster/options.h>
+#include <blaster/shedding.h>
+#include <blaster/stack_calibration.h>
+#include <blaster/stats.h>
+#include <blaster/supervisor.h>
+#include <blaster/timer_wheel.h>
+#include <blaster/upgrade.h>
 
-#ifdef DEBUG
-#define DEBUG_PRINTF(...) do{ fprintf( stderr, __VA_ARGS__ ); } while( false )
-#else
-#define DEBUG_PRINTF(...) do{ } while ( false )
-#endif
-
-// Let parsing for our request data take no more than below in seconds
-#define MAX_REQUEST_LIFETIME_S 10
 // This macro is expected to be used in something like
 // if (match_exact_path("/my_wonderful_route", client_provided_url_path, path_length, &matched))
 // Wherein you can signal that it does have an exact match.
 #define match_exact_path(client_path, path, path_length, route_has_been_matched) \
     (*route_has_been_matched = (bool)(path_length == strlen(client_path) && memcmp(path, client_path, path_length) == 0))
 
+typedef struct BLASTER_ROUTE BLASTER_ROUTE;
+
 typedef struct BLASTER_HTTP_REQUEST {
-    char *path; //4 or 8 bytes
-    int *path_length; // 4 or 8 bytes
-    struct http_parser_url *url_parser; // 4 or 8 bytes
+    // The connection's read buffer. The request's bytes stay in it until it
+    // has been answered, so everything below is an offset into it: the
+    // buffer may be grown (and move) while the request is still coming in.
+    BLASTER_BUFFER *buffer; // 4 or 8 bytes
+    size_t url_offset;
+    size_t url_length;
+    size_t path_offset;
+    size_t path_length;
+    bool headers_complete;
+    // Every header, see headers.h
+    BLASTER_HEADERS headers;
+    // Picked once the headers are in, NULL for an unknown path
+    const BLASTER_ROUTE *route;
+    // Set when a route callback failed, so a parser error is ours (500) and
+    // not the client's (400)
+    bool errored;
+    // For routes that want the whole body at once, see body_sink.h
+    BLASTER_BODY_SINK body;
+    // Content-Length of a body the route has no use for, which the
+    // connection loop steps over instead of parsing
+    uint64_t body_to_skip;
     bool *keep_alive; // 4 or 8 bytes
     bool *body_ready; // 4 or 8
     tcpsock client; // 4 or 8
 } BLASTER_HTTP_REQUEST;
 
+/*
+** A route answers one exact path. Lookup happens as soon as the headers are
+** in, so a route can start its response and consume the body while it is
+** still arriving:
+**   on_headers  optional, called once the headers are parsed
+**   on_body     optional, called with every piece of the body as it is
+**               parsed. The piece is a slice of the connection's read
+**               buffer, only valid during the call. We do not read from
+**               the socket until it returns, so a handler that blocks (on
+**               tcpsend(), say) holds the client back instead of letting the
+**               body pile up. Without it the body is discarded.
+**   respond     called once the whole request is in. Either points
+**               *response at a canned response or sends its own and sets
+**               *response_length to 0.
+** Callbacks return 0, or nonzero to fail the request with a 500.
+*/
+struct BLASTER_ROUTE {
+    const char *path;
+    int (*on_headers)(BLASTER_HTTP_REQUEST *request);
+    int (*on_body)(BLASTER_HTTP_REQUEST *request, const char *data, size_t length);
+    int (*respond)(BLASTER_HTTP_REQUEST *request, char **response, size_t *response_length);
+};
+
+static const BLASTER_ROUTE *find_route(const char *path, size_t path_length);
+
 // Handlers for parsing HTTP requests:
 int on_url_ready(http_parser* parser, const char *url, size_t length) {
+    // Called once per read the URL is spread over, with consecutive pieces
+    // of the buffer.
+    BLASTER_HTTP_REQUEST* request = (BLASTER_HTTP_REQUEST* )parser->data;
+    if (request->url_length == 0) {
+        request->url_offset = url - request->buffer->data;
+    }
+    request->url_length += length;
+    return 0;
+}
+
+int on_header_name(http_parser* parser, const char *name, size_t length) {
+    BLASTER_HTTP_REQUEST* request = (BLASTER_HTTP_REQUEST* )parser->data;
+    if (request->headers_complete) {
+        // Chunked trailers: their bytes are not kept in the buffer.
+        return 0;
+    }
+    return headers_add_name(&request->headers, name - request->buffer->data, length);
+}
+
+int on_header_value(http_parser* parser, const char *value, size_t length) {
+    BLASTER_HTTP_REQUEST* request = (BLASTER_HTTP_REQUEST* )parser->data;
+    if (!request->headers_complete) {
+        headers_add_value(&request->headers, request->buffer->data, value - request->buffer->data, length);
+    }
+    return 0;
+}
+
+int on_headers_ready(http_parser* parser) {
     BLASTER_HTTP_REQUEST* request = (BLASTER_HTTP_REQUEST* )parser->data;
-    struct http_parser_url *url_parser = request->url_parser;
+    *(request->keep_alive) = (bool) http_should_keep_alive(parser);
 
-    int result = http_parser_parse_url(url, length, parser->method == HTTP_CONNECT, url_parser);
+    // The URL is complete now.
+    struct http_parser_url url_parser;
+    http_parser_url_init(&url_parser);
+    int result = http_parser_parse_url(request->buffer->data + request->url_offset, request->url_length,
+        parser->method == HTTP_CONNECT, &url_parser);
     if (result) {
         DEBUG_PRINTF("Unexpected code %i from http_parser_url!", result);
         return -1;
     }
+    request->path_offset = request->url_offset + url_parser.field_data[UF_PATH].off;
+    request->path_length = url_parser.field_data[UF_PATH].len;
+    request->headers_complete = true;
 
-    uint16_t offset = url_parser->field_data[UF_PATH].off;
-    uint16_t path_length = url_parser->field_data[UF_PATH].len;
-
-    *request->path_length = length;
-    memcpy(request->path, url + offset, path_length);
+    request->route = find_route(request->buffer->data + request->path_offset, request->path_length);
+    if (request->route != NULL && request->route->on_headers != NULL && request->route->on_headers(request)) {
+        request->errored = true;
+        return -1;
+    }
+    if ((request->route == NULL || request->route->on_body == NULL) && !parser->upgrade &&
+            !(parser->flags & F_CHUNKED) && parser->content_length > 0 && parser->content_length != ULLONG_MAX) {
+        // Nobody wants the body. Returning 1 tells the parser there is none,
+        // so the message completes here and we skip the bytes ourselves.
+        request->body_to_skip = parser->content_length;
+        return 1;
+    }
     return 0;
 }
 
-int on_headers_ready(http_parser* parser) {
+int on_body_chunk(http_parser* parser, const char *data, size_t length) {
     BLASTER_HTTP_REQUEST* request = (BLASTER_HTTP_REQUEST* )parser->data;
-    *(request->keep_alive) = (bool) http_should_keep_alive(parser);
+    if (request->route != NULL && request->route->on_body != NULL && request->route->on_body(request, data, length)) {
+        request->errored = true;
+        return -1;
+    }
     return 0;
 }
 
 int on_body_ready(http_parser* parser) {
     BLASTER_HTTP_REQUEST* request = (BLASTER_HTTP_REQUEST* )parser->data;
     *(request->body_ready) = true;
+    // Stop at the message boundary so http_parser_execute() tells us where
+    // a pipelined request behind this one starts.
+    http_parser_pause(parser, 1);
     return 0;
 }
 
 // Hardcoded HTTP responses
 char no_keep_alive[70] = "HTTP/1.1 200 OK\r\nContent-Length: 12\r\nConnection: close\r\n\r\nHello World\n";
-char keep_alive_capable[132] = "HTTP/1.1 200 OK\r\nContent-Length: 12\r\nContent-Type: text/plain\r\nKeep-Alive: timeout=5, max=40\r\nConnection: keep-alive\r\n\r\nHello World\n";
+// Filled in by build_keep_alive_response() once the options are known
+char keep_alive_capable[160];
+size_t keep_alive_capable_length;
 
 
 char error_no_path_found[145] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 52\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\nInvalid path specifier - malformatted HTTP request?\n";
+char error_headers_too_large[145] = "HTTP/1.1 431 Request Header Fields Too Large\r\nContent-Length: 32\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\nRequest header fields too large\n";
 char error_path_too_long[108] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 15\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\nPath too long.\n";
 char error_404_not_found[107] = "HTTP/1.1 404 Not Found\r\nContent-Length: 16\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\nRoute not found\n";
 char transfer_chunked_response[73] = "HTTP/1.1 200 Ok\r\nTransfer-Encoding: chunked\r\nContent-Type: text/plain\r\n\r\n";
+char error_service_unavailable[137] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 20\r\nContent-Type: text/plain\r\nRetry-After: 1\r\nConnection: close\r\n\r\nService Unavailable\n";
 char error_server_fault[106] = "HTTP/1.1 500 Internal Server Error\r\nContent-Type: text/plain\r\nContent-Length: 23\r\n\r\nInternal Server Fault\n";
 
 const char CRLF[2] = "\r\n";
 
-void send_chunked_buffer(tcpsock client, char buffer[], size_t buffer_length) {
+/*
+** build_keep_alive_response(max_requests, idle_timeout_ms)
+** Renders the keep-alive "/" response with the Keep-Alive parameters we
+** actually enforce. Called once before any worker starts; read-only after.
+*/
+void build_keep_alive_response(int max_requests, int64_t idle_timeout_ms) {
+    char limits[32] = "";
+    if (max_requests > 0) {
+        snprintf(limits, sizeof(limits), ", max=%d", max_requests);
+    }
+    int length = snprintf(keep_alive_capable, sizeof(keep_alive_capable),
+        "HTTP/1.1 200 OK\r\nContent-Length: 12\r\nContent-Type: text/plain\r\nKeep-Alive: timeout=%d%s\r\nConnection: keep-alive\r\n\r\nHello World\n",
+        (int)(idle_timeout_ms / 1000), limits);
+    assert(length > 0 && (size_t)length < sizeof(keep_alive_capable));
+    keep_alive_capable_length = length;
+}
+
+void send_chunked_buffer(tcpsock client, const char buffer[], size_t buffer_length) {
     // First, determine how many places the str representation of buffer_length is:
     char const digit[] = "0123456789abcdef";
     size_t i = buffer_length;
@@ -101,136 +225,505 @@ void send_chunked_buffer(tcpsock client, char buffer[], size_t buffer_length) {
 }
 
 
-int handle_routes(BLASTER_HTTP_REQUEST* request, char path[], size_t path_length, char** response, size_t *response_length) {
-    bool matched = false;
+int route_root(BLASTER_HTTP_REQUEST* request, char** response, size_t *response_length) {
+    *response = no_keep_alive;
+    *response_length = sizeof(no_keep_alive);
+    if(*request->keep_alive) {
+        *response = keep_alive_capable;
+        *response_length = keep_alive_capable_length;
+    }
+    return 0;
+}
+
+int route_goredump(BLASTER_HTTP_REQUEST* request, char** response, size_t *response_length) {
+    (void)response;
     tcpsock client = request->client;
-    if (match_exact_path("/", path, path_length, &matched)) {
-        *response = no_keep_alive;
-        *response_length = sizeof(no_keep_alive);
-        if(*request->keep_alive) {
-            *response = keep_alive_capable;
-            *response_length = sizeof(keep_alive_capable);
-        }
-    } else if (match_exact_path("/goredump", path, path_length, &matched)) {
-        // signal to our send method that we're handling this.
-        *response_length = 0;
+    // signal to our send method that we're handling this.
+    *response_length = 0;
 
-        // Send preamble:
-        tcpsend(client, transfer_chunked_response, sizeof(transfer_chunked_response), -1);
+    // Send preamble:
+    tcpsend(client, transfer_chunked_response, sizeof(transfer_chunked_response), -1);
 
-        int stderr_output = dup(STDERR_FILENO);
-        int out_pipe[2];
-        if (pipe(out_pipe) != 0) {
-            return -1;
+    int stderr_output = dup(STDERR_FILENO);
+    int out_pipe[2];
+    if (pipe(out_pipe) != 0) {
+        return -1;
+    }
+    // Make our pipe non-blocking:
+    long flags = fcntl(out_pipe[0], F_GETFL);
+    flags |= O_NONBLOCK;
+    fcntl(out_pipe[0], F_SETFL, flags);
+    // Set our writer pipe end as stderr fd
+    dup2(out_pipe[1], STDERR_FILENO);
+    // close our local writer handle
+    close(out_pipe[1]);
+    // Dump status
+    goredump();
+    // flush stderr to our pipe
+    fflush(stderr);
+    // Now let's read it.
+    char goredump_buf[512] = { 0 };
+    int num_read = 0;
+    // give 5ms to scrape it all together
+    int64_t deadline = now() + 5;
+    while((num_read = read(out_pipe[0], goredump_buf, sizeof(goredump_buf)-1)) != 0) {
+        if (now() > deadline) {
+            break;
         }
-        // Make our pipe non-blocking:
-        long flags = fcntl(out_pipe[0], F_GETFL);
-        flags |= O_NONBLOCK;
-        fcntl(out_pipe[0], F_SETFL, flags);
-        // Set our writer pipe end as stderr fd
-        dup2(out_pipe[1], STDERR_FILENO);
-        // close our local writer handle
-        close(out_pipe[1]);
-        // Dump status
-        goredump();
-        // flush stderr to our pipe
-        fflush(stderr);
-        // Now let's read it.
-        char goredump_buf[512] = { 0 };
-        int num_read = 0;
-        // give 5ms to scrape it all together
-        int64_t deadline = now() + 5;
-        while((num_read = read(out_pipe[0], goredump_buf, sizeof(goredump_buf)-1)) != 0) {
-            if (now() > deadline) {
-                break;
-            }
-            if (num_read < 0) {
-                yield();
-                continue;
-            }
-            send_chunked_buffer(client, goredump_buf, num_read);
+        if (num_read < 0) {
+            yield();
+            continue;
         }
-        // Reasssign stderr_output as the primary STDERR handle
-        dup2(stderr_output, STDERR_FILENO);
-        close(out_pipe[0]);
-        // Close our local handle
-        close(stderr_output);
-        send_chunked_buffer(client, "", 0);
-    } else {
+        send_chunked_buffer(client, goredump_buf, num_read);
+    }
+    // Reasssign stderr_output as the primary STDERR handle
+    dup2(stderr_output, STDERR_FILENO);
+    close(out_pipe[0]);
+    // Close our local handle
+    close(stderr_output);
+    send_chunked_buffer(client, "", 0);
+    return 0;
+}
+
+int route_stats(BLASTER_HTTP_REQUEST* request, char** response, size_t *response_length) {
+    (void)response;
+    *response_length = 0;
+    char body[2048];
+    size_t body_length = stats_format(body, sizeof(body));
+    char header[128];
+    int header_length = snprintf(header, sizeof(header),
+        "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\n",
+        body_length);
+    tcpsend(request->client, header, header_length, -1);
+    tcpsend(request->client, body, body_length, -1);
+    *request->keep_alive = false;
+    return 0;
+}
+
+// /echo streams the request body straight back as a chunked response,
+// a chunk per piece the parser hands us.
+int route_echo_headers(BLASTER_HTTP_REQUEST* request) {
+    tcpsend(request->client, transfer_chunked_response, sizeof(transfer_chunked_response), -1);
+    return 0;
+}
+
+int route_echo_body(BLASTER_HTTP_REQUEST* request, const char *data, size_t length) {
+    send_chunked_buffer(request->client, data, length);
+    return 0;
+}
+
+int route_echo_respond(BLASTER_HTTP_REQUEST* request, char** response, size_t *response_length) {
+    (void)response;
+    *response_length = 0;
+    send_chunked_buffer(request->client, "", 0);
+    return 0;
+}
+
+// /upload takes the body through a body sink, which spills large ones to
+// a temp file, and answers with its size and FNV-1a hash.
+int route_upload_body(BLASTER_HTTP_REQUEST* request, const char *data, size_t length) {
+    return body_sink_write(&request->body, data, length);
+}
+
+int route_upload_respond(BLASTER_HTTP_REQUEST* request, char** response, size_t *response_length) {
+    (void)response;
+    if (body_sink_finish(&request->body) != 0) {
+        return -1;
+    }
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < request->body.length; ++i) {
+        hash = (hash ^ (uint8_t)request->body.data[i]) * 16777619u;
+    }
+    char body[64];
+    int body_length = snprintf(body, sizeof(body), "%zu bytes, fnv1a %08x\n", request->body.length, hash);
+    char header[128];
+    int header_length = snprintf(header, sizeof(header),
+        "HTTP/1.1 200 OK\r\nContent-Length: %d\r\nContent-Type: text/plain\r\n\r\n", body_length);
+    tcpsend(request->client, header, header_length, -1);
+    tcpsend(request->client, body, body_length, -1);
+    *response_length = 0;
+    return 0;
+}
+
+// /headers lists the request's headers from the header table, Host first
+// through its well-known slot.
+int route_headers(BLASTER_HTTP_REQUEST* request, char** response, size_t *response_length) {
+    (void)response;
+    *response_length = 0;
+    const char *buffer = request->buffer->data;
+    char body[4096];
+    size_t body_length = 0;
+    const BLASTER_HEADER *host = headers_get(&request->headers, HEADER_HOST);
+    if (host != NULL) {
+        body_length += snprintf(body, sizeof(body), "host is %.*s\n", (int)host->value_length,
+            buffer + host->value_offset);
+    }
+    for (uint32_t i = 0; i < request->headers.count && body_length < sizeof(body); ++i) {
+        const BLASTER_HEADER *header = &request->headers.entries[i];
+        body_length += snprintf(body + body_length, sizeof(body) - body_length, "%.*s: %.*s\n",
+            (int)header->name_length, buffer + header->name_offset,
+            (int)header->value_length, buffer + header->value_offset);
+    }
+    if (body_length >= sizeof(body)) {
+        // Truncated; drop the terminating NUL snprintf() left at the end.
+        body_length = sizeof(body) - 1;
+    }
+    char header[128];
+    int header_length = snprintf(header, sizeof(header),
+        "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\nContent-Type: text/plain\r\n\r\n", body_length);
+    tcpsend(request->client, header, header_length, -1);
+    tcpsend(request->client, body, body_length, -1);
+    return 0;
+}
+
+static const BLASTER_ROUTE routes[] = {
+    {"/", NULL, NULL, route_root},
+    {"/goredump", NULL, NULL, route_goredump},
+    {"/stats", NULL, NULL, route_stats},
+    {"/echo", route_echo_headers, route_echo_body, route_echo_respond},
+    {"/upload", NULL, route_upload_body, route_upload_respond},
+    {"/headers", NULL, NULL, route_headers},
+};
+
+static const BLASTER_ROUTE *find_route(const char *path, size_t path_length) {
+    bool matched = false;
+    for (size_t i = 0; i < sizeof(routes) / sizeof(routes[0]); ++i) {
+        if (match_exact_path(routes[i].path, path, path_length, &matched)) {
+            return &routes[i];
+        }
+    }
+    return NULL;
+}
+
+int handle_routes(BLASTER_HTTP_REQUEST* request, char** response, size_t *response_length) {
+    if (request->route == NULL) {
         *response = error_404_not_found;
         *response_length = sizeof(error_404_not_found);
-        matched = true;
+        return 0;
     }
-    return !matched;
+    return request->route->respond(request, response, response_length);
+}
+
+// What a connection is waiting on: decides which timeout applies and what a
+// dropped connection is counted as.
+typedef enum BLASTER_PHASE {
+    PHASE_HEADERS,
+    PHASE_BODY,
+    PHASE_SEND,
+    PHASE_IDLE,
+} BLASTER_PHASE;
+
+static void count_timeout(BLASTER_PHASE phase) {
+    switch (phase) {
+        case PHASE_HEADERS:
+            blaster_stats.drops_header_timeout++;
+            break;
+        case PHASE_BODY:
+            blaster_stats.drops_body_timeout++;
+            break;
+        case PHASE_SEND:
+            blaster_stats.drops_send_timeout++;
+            break;
+        case PHASE_IDLE:
+            blaster_stats.idle_timeouts++;
+            break;
+    }
+}
+
+/*
+** too_slow(options, phase_started_ms, phase_bytes)
+** Slowloris defense: after the grace period, a client sending its headers
+** or body slower than --min-data-rate is not worth a coroutine.
+*/
+static bool too_slow(const BLASTER_OPTIONS *options, int64_t phase_started_ms, uint64_t phase_bytes) {
+    if (options->min_data_rate <= 0) {
+        return false;
+    }
+    int64_t elapsed_ms = now() - phase_started_ms;
+    if (elapsed_ms <= options->min_data_rate_grace_ms) {
+        return false;
+    }
+    return phase_bytes * 1000 < (uint64_t)options->min_data_rate * (uint64_t)elapsed_ms;
 }
 
 /*
-** handle_request(tcpsock client)
-** This is our request handler. It sets up an HTTP parser, signals various
-** boolean pointers to indicate state, defines deadlines and invokes a yield after
-** a potentially expensive function (parsing HTTP headers).
+** handle_request(client, client_fd, accepted_ms, options, settings)
+** This is our connection handler. It sets up an HTTP parser, signals various
+** boolean pointers to indicate state and arms timeouts. Between reads it
+** parks in fdwait() on the raw client fd, so an idle connection costs nothing
+** until the kernel says there is something to read.
+**
+** Each phase of a request has its own timeout on the worker's timer wheel:
+** reading the headers (counted from accept, or from the first byte of a
+** later request), reading the body, sending the response and sitting idle
+** between keep-alive requests. The timer is re-armed only when the phase
+** changes; when it fires it shuts the socket down, which wakes us up.
+** While headers or a body come in we also keep track of the data rate, see
+** too_slow().
 ** The on_ functions above are used to checkpoint states in parsing and convey data
 ** back to the suspended coroutine.
 **
+** Keep-alive requests are served by looping in place over the same locals,
+** resetting the parser with http_parser_init(), so stack use stays constant
+** however many requests a connection makes, up to options->max_requests (0
+** means no limit).
+**
 ** Stack allocation is used in conjunction with pointers to elide expensive copying of structs
 ** and costly malloc()s
 */
-coroutine void handle_request(tcpsock client, int64_t start_time_ms, int requests_left, http_parser_settings *settings) {
-    char path[200] = {0};
-    int path_length = 0;
-    struct http_parser_url url_parser;
-    http_parser_url_init(&url_parser);
-
-    bool keep_alive = false;
-    bool body_ready = false;
-
-    BLASTER_HTTP_REQUEST request = {path, &path_length, &url_parser, &keep_alive, &body_ready, client};
+coroutine void handle_request(tcpsock client, int client_fd, int64_t accepted_ms, const BLASTER_OPTIONS *options, http_parser_settings *settings) {
+    // Taken from the worker's pool while there is something to parse and
+    // given back whenever the connection is idle.
+    BLASTER_BUFFER buffer = {NULL, 0};
+    bool keep_alive;
+    bool body_ready;
 
+    BLASTER_HTTP_REQUEST request = {
+        .buffer = &buffer,
+        .keep_alive = &keep_alive,
+        .body_ready = &body_ready,
+        .client = client,
+    };
 
+    body_sink_reset(&request.body);
     http_parser parser = {.data = &request};
-    http_parser_init(&parser, HTTP_REQUEST);
 
-    int64_t last_wakeup = 0;
     ipaddr client_address = tcpaddr(client);
-    int64_t end_time_ts = start_time_ms + MAX_REQUEST_LIFETIME_S*1000;
-
-    while(now() < end_time_ts) {
-        char buf[2048] = {0};
-        size_t num_bytes_read = tcprecv(client, buf, sizeof(buf), now());
-        if (errno == ECONNRESET) {
-            char client_address_repr[IPADDR_MAXSTRLEN];
-            ipaddrstr(client_address, client_address_repr);
-            DEBUG_PRINTF("[PID %i] Client %s sent RST, %d requests left\n", getpid(), client_address_repr, requests_left);
+    int requests_served = 0;
+    bool started = false;
+    bool shed = false;
+    bool malformed = false;
+    bool too_large = false;
+    // buffer.data holds buffered bytes of which the parser has seen consumed.
+    // Anything past consumed is the start of a pipelined request.
+    size_t buffered = 0;
+    size_t consumed = 0;
+    // Responses sent with tcpsend() but not flushed yet. Pipelined requests
+    // are all answered before a single flush.
+    bool unflushed = false;
+    BLASTER_TIMER timer = {0};
+    BLASTER_IDLE idle_entry;
+    BLASTER_PHASE phase = PHASE_HEADERS;
+    timer_arm(&timer, client_fd, options->header_timeout_ms);
+    // Bytes received since the header or body phase started
+    int64_t phase_started_ms = accepted_ms;
+    uint64_t phase_bytes = 0;
+    bool slow = false;
+    for (;;) {
+        if (consumed > 0) {
+            // Move a pipelined request to the front so its offsets start at 0.
+            memmove(buffer.data, buffer.data + consumed, buffered - consumed);
+            buffered -= consumed;
+            consumed = 0;
+        }
+        request.url_offset = 0;
+        request.url_length = 0;
+        request.path_offset = 0;
+        request.path_length = 0;
+        request.headers_complete = false;
+        headers_reset(&request.headers);
+        request.route = NULL;
+        request.errored = false;
+        body_sink_release(&request.body);
+        request.body_to_skip = 0;
+        keep_alive = false;
+        body_ready = false;
+        http_parser_init(&parser, HTTP_REQUEST);
+        http_parser_set_max_header_size(&parser, options->max_header_size);
+        started = false;
+        if (requests_served > 0) {
+            phase = PHASE_IDLE;
+            timer_arm(&timer, client_fd, options->idle_timeout_ms);
+        }
+
+        while(!body_ready) {
+            if (consumed == buffered) {
+                if (unflushed) {
+                    // Answers to the requests in front of this partial one
+                    // should not wait for the rest of it.
+                    tcpflush(client, -1);
+                    unflushed = false;
+                    if (timer.expired) {
+                        // The header timer ran out while we were sending.
+                        count_timeout(phase);
+                        break;
+                    }
+                }
+                if (buffer.data == NULL && buffer_acquire(&buffer) != 0) {
+                    break;
+                }
+                if (buffered == buffer.capacity) {
+                    if (request.headers_complete) {
+                        // Past the headers: only the URL and the headers
+                        // are still needed, the body bytes behind them have
+                        // been parsed.
+                        size_t keep = headers_end(&request.headers);
+                        if (keep < request.url_offset + request.url_length) {
+                            keep = request.url_offset + request.url_length;
+                        }
+                        buffered = consumed = keep;
+                    } else if (buffer_grow(&buffer, buffered) != 0) {
+                        too_large = true;
+                        break;
+                    }
+                }
+                ssize_t num_bytes_read = recv(client_fd, buffer.data + buffered, buffer.capacity - buffered, 0);
+                if (num_bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    if (draining() && !started && requests_served > 0) {
+                        // Idle keep-alive connection on a worker that is going away.
+                        break;
+                    }
+                    if (buffered == 0) {
+                        // Idle: nobody needs a buffer to wait.
+                        buffer_release(&buffer);
+                    }
+                    // Sleep until the client sends something or the timer
+                    // (or a drain, between requests) shuts the socket down.
+                    bool idle = !started && requests_served > 0;
+                    if (idle) {
+                        drain_idle_begin(&idle_entry, client_fd);
+                    }
+                    fdwait(client_fd, FDW_IN, -1);
+                    if (idle) {
+                        drain_idle_end(&idle_entry);
+                    }
+                    continue;
+                }
+                if (num_bytes_read <= 0) {
+                    if (timer.expired) {
+                        count_timeout(phase);
+                    }
+                    char client_address_repr[IPADDR_MAXSTRLEN];
+                    ipaddrstr(client_address, client_address_repr);
+                    DEBUG_PRINTF("[PID %i] Client %s %s after %d requests\n", getpid(), client_address_repr,
+                        timer.expired ? "timed out" : num_bytes_read == 0 ? "closed the connection" : "sent RST",
+                        requests_served);
+                    break;
+                }
+                buffered += num_bytes_read;
+                phase_bytes += num_bytes_read;
+                if ((phase == PHASE_HEADERS || phase == PHASE_BODY) && too_slow(options, phase_started_ms, phase_bytes)) {
+                    if (phase == PHASE_HEADERS) {
+                        blaster_stats.drops_slow_headers++;
+                    } else {
+                        blaster_stats.drops_slow_body++;
+                    }
+                    slow = true;
+                    break;
+                }
+            } else if (!started) {
+                // Left over from the last read: the client pipelined it.
+                blaster_stats.requests_pipelined++;
+            }
+            if (!started) {
+                started = true;
+                if (requests_served == 0) {
+                    // First bytes of a new connection: how long did it wait for us?
+                    if (shedding_should_shed(now() - accepted_ms)) {
+                        shed = true;
+                        break;
+                    }
+                } else {
+                    phase = PHASE_HEADERS;
+                    timer_arm(&timer, client_fd, options->header_timeout_ms);
+                    phase_started_ms = now();
+                    phase_bytes = buffered - consumed;
+                }
+            }
+            consumed += http_parser_execute(&parser, settings, buffer.data + consumed, buffered - consumed);
+            if (request.headers_complete && phase == PHASE_HEADERS && !body_ready) {
+                phase = PHASE_BODY;
+                timer_arm(&timer, client_fd, options->body_timeout_ms);
+                phase_started_ms = now();
+                phase_bytes = buffered - consumed;
+            }
+            if (HTTP_PARSER_ERRNO(&parser) != HPE_OK && HTTP_PARSER_ERRNO(&parser) != HPE_PAUSED) {
+                if (request.errored) {
+                    break;
+                }
+                if (HTTP_PARSER_ERRNO(&parser) == HPE_HEADER_OVERFLOW || request.headers.full) {
+                    too_large = true;
+                    break;
+                }
+                DEBUG_PRINTF("Malformed request: %s\n", http_errno_name(HTTP_PARSER_ERRNO(&parser)));
+                malformed = true;
+                break;
+            }
+        }
+        if (body_ready && request.body_to_skip > 0) {
+            // Step over the body instead of running it through the parser.
+            // Whatever is still in the socket is discarded with MSG_TRUNC, so
+            // it is not even copied out of the kernel.
+            phase = PHASE_BODY;
+            timer_arm(&timer, client_fd, options->body_timeout_ms);
+            uint64_t remaining = request.body_to_skip;
+            size_t in_buffer = buffered - consumed;
+            size_t step = remaining < in_buffer ? (size_t)remaining : in_buffer;
+            consumed += step;
+            remaining -= step;
+            while (remaining > 0) {
+                size_t chunk = remaining < (1 << 30) ? (size_t)remaining : (1 << 30);
+                ssize_t skipped = recv(client_fd, NULL, chunk, MSG_TRUNC);
+                if (skipped < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    fdwait(client_fd, FDW_IN, -1);
+                    continue;
+                }
+                if (skipped <= 0) {
+                    if (timer.expired) {
+                        count_timeout(phase);
+                    }
+                    // The client went away mid-body; nobody to answer.
+                    body_ready = false;
+                    break;
+                }
+                remaining -= skipped;
+            }
+            blaster_stats.bodies_skipped++;
+            blaster_stats.body_bytes_skipped += request.body_to_skip - remaining;
+        }
+        if (slow) {
+            // Not worth a response; the client would take ages to read it.
             break;
         }
-        if(num_bytes_read > 0) {
-            last_wakeup = now();
-            http_parser_execute(&parser, settings, buf, num_bytes_read);
-        } else {
-            yield();
+        phase = PHASE_SEND;
+        timer_arm(&timer, client_fd, options->send_timeout_ms);
+        if (shed) {
+            // Overloaded: skip parsing and routing entirely.
+            tcpsend(client, error_service_unavailable, sizeof(error_service_unavailable), -1);
+            break;
         }
-        if (now() - last_wakeup >= 5*1000 && keep_alive) {
-            char client_address_repr[IPADDR_MAXSTRLEN];
-            ipaddrstr(client_address, client_address_repr);
-            DEBUG_PRINTF("[PID %i] Client %s idled for more than 5 seconds with %d requests left over. Flushing and closing.\n", getpid(), client_address_repr, requests_left);
-            tcpflush(client, -1);
+        if (malformed) {
+            tcpsend(client, error_no_path_found, sizeof(error_no_path_found), -1);
             break;
         }
-        if(body_ready) {
+        if (too_large) {
+            tcpsend(client, error_headers_too_large, sizeof(error_headers_too_large), -1);
             break;
         }
-    }
-    bool errored = false;
-    if (body_ready) {
+        if (request.errored) {
+            tcpsend(client, error_server_fault, sizeof(error_server_fault), -1);
+            unflushed = true;
+            break;
+        }
+        if (!body_ready) {
+            break;
+        }
+        requests_served++;
+        if (draining() || (options->max_requests > 0 && requests_served >= options->max_requests)) {
+            // Answer this one, but tell the client not to come back here.
+            keep_alive = false;
+        }
+        bool errored = false;
         char* response = error_no_path_found;
         size_t response_length = sizeof(error_no_path_found);
+        size_t path_length = request.path_length;
         if (path_length > 0) {
             if (path_length > 199) {
                 response = error_path_too_long;
                 response_length = sizeof(error_path_too_long);
             } else {
                 // Do your routing magic
-                int err = handle_routes(&request, path, path_length, &response, &response_length);
+                int err = handle_routes(&request, &response, &response_length);
                 if (err) {
                     response = error_server_fault;
                     response_length = sizeof(error_server_fault);
@@ -241,80 +734,265 @@ coroutine void handle_request(tcpsock client, int64_t start_time_ms, int request
         if (response_length > 0) {
             tcpsend(client, response, response_length, -1);
         }
-        tcpflush(client, -1);
-        if (!errored) {
-            if (keep_alive && requests_left > 0) {
-                DEBUG_PRINTF("Connection is left as keep-alive.\n");
-                goto reuse;
+        unflushed = true;
+        if (errored || !keep_alive) {
+            break;
+        }
+        if (consumed == buffered) {
+            // Nothing pipelined behind this request; send what we have.
+            tcpflush(client, -1);
+            unflushed = false;
+            if (timer.expired) {
+                count_timeout(phase);
+                break;
             }
         }
+        DEBUG_PRINTF("Connection is left as keep-alive.\n");
     }
+    if (requests_served == 0 && !started) {
+        // Never sent us a byte.
+        blaster_stats.connections_empty++;
+    }
+    // Whatever is still queued: the last batch of responses, a 503 or a 4xx.
+    if (unflushed || shed || malformed || too_large) {
+        tcpflush(client, -1);
+    }
+    timer_cancel(&timer);
+    body_sink_release(&request.body);
+    buffer_release(&buffer);
     DEBUG_PRINTF("Closing connection\n");
     tcpclose(client);
-    return;
-    reuse:
-        handle_request(client, start_time_ms, requests_left - 1, settings);
+    admission_connection_closed();
 }
 
-int main(int arg_count, char* args[]) {
-    int port = 5555;
-    int num_processes = 1;
-    if (arg_count > 1) {
-        port = atoi(args[1]);
-        if (arg_count > 2) {
-            num_processes = atoi(args[2]);
-        }
-    }
-    if (port < 1) {
-        perror("Ports cannot be less than 1");
-        return 1;
-    }
-    if (num_processes < 1) {
-        perror("Num processes cannot be less than 1");
-        return 2;
-    }
-    ipaddr address = iplocal(NULL, port, 0);
-    tcpsock server_socket = tcplisten(address, 10);
-    pid_t current_pid = getpid();
-    printf("Starting %d process(es)\n", num_processes);
-    if (num_processes > 1) {
-        for (int i = 0; i < num_processes - 1; ++i) {
-            pid_t pid = mfork();
-            if (pid < 0) {
-                perror("Cannot fork processes");
-                return 4;
-            }
-            if (pid > 0) {
-                current_pid = pid;
-                break;
-            }
-        }
-    }
+/*
+** handle_request_calibrated(...)
+** handle_request with the rest of the coroutine stack painted beforehand,
+** for --calibrate-stacks. Painting happens here, one frame above
+** handle_request, so none of its locals are in the painted range.
+*/
+coroutine void handle_request_calibrated(tcpsock client, int client_fd, int64_t accepted_ms, const BLASTER_OPTIONS *options, http_parser_settings *settings, size_t paint_bytes) {
+    volatile char stack_base = 0;
+    stack_paint(&stack_base, paint_bytes);
+    handle_request(client, client_fd, accepted_ms, options, settings);
+    stack_record(stack_measure(&stack_base, paint_bytes));
+}
 
-    if (server_socket == NULL) {
-        printf("Cannot open listening socket on port %d", port);
-        return 3;
-    }
-    printf("[%i] Listening on port %d\n", current_pid, port);
+/*
+** run_worker(options, worker_index, listen_fd)
+** Everything a single worker process does: set up the parser settings and
+** coroutine pool, then accept connections on listen_fd until we are asked
+** to drain (SIGQUIT), at which point we stop accepting and wait for the
+** connections we have to finish.
+*/
+static int run_worker(const BLASTER_OPTIONS *options, int worker_index, int listen_fd) {
+    printf("[%i] Worker %d listening on port %d\n", getpid(), worker_index, options->port);
+    fflush(stdout);
     // Since we're always parsing things the same way, let's share the stack alloc'ed
     // settings
     http_parser_settings settings;
     http_parser_settings_init(&settings);
     settings.on_url = on_url_ready;
+    settings.on_header_field = on_header_name;
+    settings.on_header_value = on_header_value;
     settings.on_headers_complete = on_headers_ready;
+    settings.on_body = on_body_chunk;
     settings.on_message_complete = on_body_ready;
-    goprepare(1000, 100000, 128);
+    if (options->cpu_nodes != NULL) {
+        // Before goprepare() so the stacks (and everything after) are local.
+        int node = options->cpu_nodes[worker_index % options->num_cpus];
+        if (node >= 0 && numa_bind_memory(node) != 0) {
+            fprintf(stderr, "[%i] Cannot bind worker %d memory to node %d: %s\n", getpid(), worker_index, node, strerror(errno));
+        }
+    }
+    goprepare(options->coroutines, options->stack_size, options->value_size);
+    size_t paint_bytes = options->stack_size - STACK_CALIBRATION_RESERVE;
+    drain_init();
+    int accept_set = listener_wait_set(listen_fd, drain_fd());
+    if (accept_set < 0) {
+        perror("Cannot create accept wait set");
+        return 3;
+    }
+    supervisor_worker_ready();
 
     // Event loop
-    // Any time our server_socket is ready, check if the client socket is good
-    // the launch a fiber to deal with it.
-    while(true) {
-        int64_t deadline = now() + 10;
-        tcpsock client_tunnel = tcpaccept(server_socket, deadline);
-        if (client_tunnel == NULL) {
-            continue;
+    // Sleep until the listener is readable, then drain up to accept_batch
+    // pending connections and launch a fiber for each before waiting again.
+    // While admission control has us over the high-water mark we don't
+    // accept at all, and new clients wait in the kernel's listen queue.
+    admission_init(options->max_connections, options->resume_connections);
+    shedding_init(options->shed_target_ms, options->shed_interval_ms);
+    buffer_pool_init(options->max_buffer_size);
+    timer_wheel_init();
+    body_sink_init(options->spill_threshold, options->spill_directory);
+    int accept_batch = options->accept_batch;
+    int client_fds[accept_batch];
+    while(!draining()) {
+        int room = admission_wait();
+        fdwait(accept_set, FDW_IN, -1);
+        if (draining()) {
+            break;
+        }
+        int batch = room < accept_batch ? room : accept_batch;
+        int num_accepted = listener_accept_batch(listen_fd, client_fds, batch);
+        int accept_errno = errno;
+
+        blaster_stats.accept_wakeups++;
+        blaster_stats.accepted += num_accepted;
+        if (num_accepted == 0) {
+            blaster_stats.accept_empty_wakeups++;
+        }
+        if ((uint64_t)num_accepted > blaster_stats.accept_max_batch) {
+            blaster_stats.accept_max_batch = num_accepted;
+        }
+
+        for (int i = 0; i < num_accepted; ++i) {
+            listener_inspect_accepted(client_fds[i], &options->listener);
+            tcpsock client_tunnel = tcpattach(client_fds[i], 0);
+            if (client_tunnel == NULL) {
+                close(client_fds[i]);
+                continue;
+            }
+            admission_connection_opened();
+            if (options->calibrate_stacks) {
+                go(handle_request_calibrated(client_tunnel, client_fds[i], now(), options, &settings, paint_bytes));
+            } else {
+                go(handle_request(client_tunnel, client_fds[i], now(), options, &settings));
+            }
+        }
+        if (num_accepted < batch && accept_errno != EAGAIN && accept_errno != EWOULDBLOCK) {
+            // Out of descriptors or similar. The listener stays readable, so
+            // back off instead of spinning on it.
+            DEBUG_PRINTF("[PID %i] accept4 failed: %s\n", getpid(), strerror(accept_errno));
+            msleep(now() + 10);
+        }
+    }
+
+    // The listener itself stays open in the master (and in the next
+    // generation after an upgrade); we just stop taking from it.
+    fdclean(accept_set);
+    close(accept_set);
+    close(listen_fd);
+    // Those between requests would otherwise sit out their idle timeout.
+    drain_close_idle();
+    printf("[%i] Worker %d draining %d connection(s)\n", getpid(), worker_index, (int)blaster_stats.live_connections);
+    fflush(stdout);
+    int left_open = drain_connections(options->drain_timeout_ms);
+    if (left_open > 0) {
+        printf("[%i] Worker %d gave up on %d connection(s)\n", getpid(), worker_index, left_open);
+    }
+    if (options->calibrate_stacks) {
+        printf("[%i] Worker %d stack high-water %llu bytes over %llu connection(s), suggest --stack-size %zu\n",
+            getpid(), worker_index, (unsigned long long)blaster_stats.stack_high_water,
+            (unsigned long long)blaster_stats.stack_samples, stack_suggested_size());
+    }
+    return 0;
+}
+
+typedef struct BLASTER_THREAD {
+    pthread_t thread;
+    const BLASTER_OPTIONS *options;
+    int index;
+    int listen_fd;
+} BLASTER_THREAD;
+
+static void *run_worker_thread(void *arg) {
+    BLASTER_THREAD *thread = (BLASTER_THREAD *)arg;
+    const BLASTER_OPTIONS *options = thread->options;
+    if (options->num_cpus > 0) {
+        int cpu = options->cpus[thread->index % options->num_cpus];
+        if (pin_to_cpu(cpu) != 0) {
+            fprintf(stderr, "Cannot pin thread %d to CPU %d: %s\n", thread->index, cpu, strerror(errno));
+        }
+    }
+    run_worker(options, thread->index, thread->listen_fd);
+    return NULL;
+}
+
+/*
+** run_threads(options, listeners)
+** Thread-per-core mode: every thread runs run_worker() on its own listener
+** with its own libmill scheduler, coroutine pool, stats and admission
+** control, so nothing on the request path is shared or locked. Read-only
+** data (responses, parser settings) is shared by virtue of one address space.
+** Needs a libmill built with per-thread schedulers.
+*/
+static int run_threads(const BLASTER_OPTIONS *options, const int listeners[]) {
+    int num_threads = options->num_threads;
+    BLASTER_THREAD threads[num_threads];
+    printf("[%i] Starting %d thread(s)\n", getpid(), num_threads);
+    for (int i = 0; i < num_threads; ++i) {
+        threads[i].options = options;
+        threads[i].index = i;
+        threads[i].listen_fd = listeners[i];
+        int error = pthread_create(&threads[i].thread, NULL, run_worker_thread, &threads[i]);
+        if (error != 0) {
+            fprintf(stderr, "Cannot start thread %d: %s\n", i, strerror(error));
+            return 4;
         }
-        go(handle_request(client_tunnel, now(), 40, &settings));
+    }
+    for (int i = 0; i < num_threads; ++i) {
+        pthread_join(threads[i].thread, NULL);
     }
     return 0;
 }
+
+int main(int arg_count, char* args[]) {
+    BLASTER_OPTIONS options;
+    int status = parse_options(arg_count, args, &options);
+    if (status) {
+        return status < 0 ? 0 : status;
+    }
+    int port = options.port;
+    int num_workers = options_num_workers(&options);
+    build_keep_alive_response(options.max_requests, options.idle_timeout_ms);
+    headers_init();
+    if (options.numa && numa_plan(&options) != 0) {
+        return 7;
+    }
+    ipaddr address = iplocal(NULL, port, 0);
+
+    // With reuseport every worker gets a listener of its own. They are all
+    // opened here, in worker order, so the index of a socket in the reuseport
+    // group matches the worker (and CPU) that serves it.
+    int num_listeners = options.reuseport ? num_workers : 1;
+    int listeners[num_listeners];
+    // During an upgrade the previous generation hands us its sockets instead,
+    // steering program and queued connections included.
+    int inherited = upgrade_inherit_listeners(listeners, num_listeners);
+    if (inherited < 0) {
+        printf("Cannot take over listening sockets from the previous generation\n");
+        return 6;
+    }
+    for (int i = 0; i < num_listeners; ++i) {
+        if (inherited) {
+            // Picks up changed listener options, like --backlog.
+            if (listener_configure(listeners[i], &options.listener) != 0) {
+                perror("Cannot reconfigure inherited listener");
+            }
+            continue;
+        }
+        listeners[i] = listener_open(address, &options.listener);
+        if (listeners[i] < 0) {
+            printf("Cannot open listening socket on port %d: %s\n", port, strerror(errno));
+            return 3;
+        }
+    }
+    if (!inherited && options.cpu_steering && listener_attach_cpu_steering(listeners[0], num_listeners) != 0) {
+        perror("Cannot attach CPU steering program");
+        return 5;
+    }
+
+    if (options.supervise) {
+        return supervise(&options, listeners, num_listeners, run_worker);
+    }
+    // Only a master can hand the listeners to a new generation.
+    upgrade_refuse();
+    if (options.num_threads > 1) {
+        return run_threads(&options, listeners);
+    }
+    if (options.num_cpus > 0 && pin_to_cpu(options.cpus[0]) != 0) {
+        perror("Cannot pin worker to its CPU");
+    }
+    return run_worker(&options, 0, listeners[0]);
+}
@@ -0,0 +1,66 @@
+#include <libmill.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <blaster/admission.h>
+#include <blaster/drain.h>
+#include <blaster/stats.h>
+
+// Per thread, like the scheduler it parks the accept loop on.
+static _Thread_local int admission_high_water;
+static _Thread_local int admission_low_water;
+static _Thread_local bool admission_paused;
+// Buffered so the handler that gets us under the low-water mark never blocks
+// on the accept loop.
+static _Thread_local chan admission_channel;
+
+static _Thread_local bool admission_watching_drain;
+
+// A drain must not wait for connections to fall to the low-water mark
+// first, so it wakes a paused accept loop as well.
+static coroutine void admission_wake_on_drain(void) {
+    fdwait(drain_fd(), FDW_IN, -1);
+    if (admission_paused) {
+        admission_paused = false;
+        chs(admission_channel, int, 0);
+    }
+}
+
+void admission_init(int high_water, int low_water) {
+    admission_high_water = high_water;
+    admission_low_water = low_water;
+    admission_paused = false;
+    if (admission_channel == NULL) {
+        admission_channel = chmake(int, 1);
+    }
+    if (high_water > 0 && !admission_watching_drain && drain_fd() >= 0) {
+        admission_watching_drain = true;
+        go(admission_wake_on_drain());
+    }
+}
+
+int admission_wait(void) {
+    if (admission_high_water <= 0) {
+        return INT_MAX;
+    }
+    if (blaster_stats.live_connections >= (uint64_t)admission_high_water) {
+        admission_paused = true;
+        blaster_stats.admission_pauses++;
+        (void)chr(admission_channel, int);
+        if (draining()) {
+            return 0;
+        }
+    }
+    return admission_high_water - (int)blaster_stats.live_connections;
+}
+
+void admission_connection_opened(void) {
+    blaster_stats.live_connections++;
+}
+
+void admission_connection_closed(void) {
+    blaster_stats.live_connections--;
+    if (admission_paused && blaster_stats.live_connections <= (uint64_t)admission_low_water) {
+        admission_paused = false;
+        chs(admission_channel, int, 0);
+    }
+}
@@ -0,0 +1,124 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <blaster/body_sink.h>
+#include <blaster/stats.h>
+
+static _Thread_local size_t body_sink_threshold;
+static _Thread_local const char *body_sink_directory;
+
+void body_sink_init(size_t threshold, const char *directory) {
+    body_sink_threshold = threshold;
+    body_sink_directory = directory;
+}
+
+void body_sink_reset(BLASTER_BODY_SINK *sink) {
+    memset(sink, 0, sizeof(*sink));
+    sink->fd = -1;
+}
+
+// An anonymous file: O_TMPFILE where the filesystem has it, otherwise
+// mkstemp() and unlink() straight away.
+static int open_spill_file(void) {
+    int fd = open(body_sink_directory, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0 || (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL)) {
+        return fd;
+    }
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/blaster-body-XXXXXX", body_sink_directory) >= (int)sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    fd = mkostemp(path, O_CLOEXEC);
+    if (fd >= 0) {
+        unlink(path);
+    }
+    return fd;
+}
+
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+static int spill(BLASTER_BODY_SINK *sink) {
+    sink->fd = open_spill_file();
+    if (sink->fd < 0) {
+        return -1;
+    }
+    if (write_all(sink->fd, sink->memory.data, sink->length) != 0) {
+        return -1;
+    }
+    buffer_release(&sink->memory);
+    blaster_stats.bodies_spilled++;
+    return 0;
+}
+
+int body_sink_write(BLASTER_BODY_SINK *sink, const char *data, size_t length) {
+    if (sink->fd < 0) {
+        if (sink->length + length > body_sink_threshold) {
+            if (spill(sink) != 0) {
+                return -1;
+            }
+        } else {
+            if (sink->memory.data == NULL && buffer_acquire(&sink->memory) != 0) {
+                errno = ENOMEM;
+                return -1;
+            }
+            while (sink->length + length > sink->memory.capacity) {
+                if (buffer_grow(&sink->memory, sink->length) != 0) {
+                    // The pool would not grow this far; the file will.
+                    return spill(sink) == 0 ? body_sink_write(sink, data, length) : -1;
+                }
+            }
+            memcpy(sink->memory.data + sink->length, data, length);
+            sink->length += length;
+            return 0;
+        }
+    }
+    if (write_all(sink->fd, data, length) != 0) {
+        return -1;
+    }
+    sink->length += length;
+    return 0;
+}
+
+int body_sink_finish(BLASTER_BODY_SINK *sink) {
+    if (sink->fd < 0) {
+        sink->data = sink->memory.data;
+        return 0;
+    }
+    void *mapping = mmap(NULL, sink->length, PROT_READ, MAP_PRIVATE, sink->fd, 0);
+    if (mapping == MAP_FAILED) {
+        return -1;
+    }
+    sink->data = mapping;
+    sink->mapped_length = sink->length;
+    return 0;
+}
+
+void body_sink_release(BLASTER_BODY_SINK *sink) {
+    if (sink->mapped_length > 0) {
+        munmap((void *)sink->data, sink->mapped_length);
+    }
+    if (sink->fd >= 0) {
+        close(sink->fd);
+    }
+    buffer_release(&sink->memory);
+    body_sink_reset(sink);
+}
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+#include <blaster/buffer_pool.h>
+#include <blaster/stats.h>
+
+// A free buffer's first bytes link it to the next free one.
+typedef struct BUFFER_POOL_ENTRY {
+    struct BUFFER_POOL_ENTRY *next;
+} BUFFER_POOL_ENTRY;
+
+// Per thread, like the connections that use it. Slabs live as long as the
+// worker does.
+static _Thread_local BUFFER_POOL_ENTRY *buffer_pool_free;
+static _Thread_local size_t buffer_pool_max_size;
+
+void buffer_pool_init(size_t max_size) {
+    buffer_pool_max_size = max_size < BUFFER_POOL_BUFFER_SIZE ? BUFFER_POOL_BUFFER_SIZE : max_size;
+}
+
+static int buffer_pool_refill(void) {
+    char *slab = malloc((size_t)BUFFER_POOL_BUFFER_SIZE * BUFFER_POOL_SLAB_BUFFERS);
+    if (slab == NULL) {
+        return -1;
+    }
+    for (int i = BUFFER_POOL_SLAB_BUFFERS - 1; i >= 0; --i) {
+        BUFFER_POOL_ENTRY *entry = (BUFFER_POOL_ENTRY *)(slab + (size_t)i * BUFFER_POOL_BUFFER_SIZE);
+        entry->next = buffer_pool_free;
+        buffer_pool_free = entry;
+    }
+    blaster_stats.buffers_pooled += BUFFER_POOL_SLAB_BUFFERS;
+    return 0;
+}
+
+int buffer_acquire(BLASTER_BUFFER *buffer) {
+    if (buffer_pool_free == NULL && buffer_pool_refill() != 0) {
+        return -1;
+    }
+    BUFFER_POOL_ENTRY *entry = buffer_pool_free;
+    buffer_pool_free = entry->next;
+    buffer->data = (char *)entry;
+    buffer->capacity = BUFFER_POOL_BUFFER_SIZE;
+    blaster_stats.buffers_in_use++;
+    return 0;
+}
+
+int buffer_grow(BLASTER_BUFFER *buffer, size_t used) {
+    if (buffer->capacity >= buffer_pool_max_size) {
+        return -1;
+    }
+    size_t capacity = buffer->capacity * 2;
+    if (capacity > buffer_pool_max_size) {
+        capacity = buffer_pool_max_size;
+    }
+    char *data;
+    if (buffer->capacity == BUFFER_POOL_BUFFER_SIZE) {
+        // Leaving the pool: copy out and give the pooled buffer back.
+        data = malloc(capacity);
+        if (data == NULL) {
+            return -1;
+        }
+        memcpy(data, buffer->data, used);
+        BUFFER_POOL_ENTRY *entry = (BUFFER_POOL_ENTRY *)buffer->data;
+        entry->next = buffer_pool_free;
+        buffer_pool_free = entry;
+    } else {
+        data = realloc(buffer->data, capacity);
+        if (data == NULL) {
+            return -1;
+        }
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    blaster_stats.buffers_grown++;
+    return 0;
+}
+
+void buffer_release(BLASTER_BUFFER *buffer) {
+    if (buffer->data == NULL) {
+        return;
+    }
+    if (buffer->capacity == BUFFER_POOL_BUFFER_SIZE) {
+        BUFFER_POOL_ENTRY *entry = (BUFFER_POOL_ENTRY *)buffer->data;
+        entry->next = buffer_pool_free;
+        buffer_pool_free = entry;
+    } else {
+        free(buffer->data);
+    }
+    buffer->data = NULL;
+    buffer->capacity = 0;
+    blaster_stats.buffers_in_use--;
+}
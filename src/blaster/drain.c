@@ -0,0 +1,102 @@
+#include <libmill.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <blaster/drain.h>
+#include <blaster/stats.h>
+
+// How often a draining worker checks whether its connections are gone
+#define DRAIN_POLL_MS 100
+
+static volatile sig_atomic_t drain_requested;
+static int drain_event_fd = -1;
+static pthread_once_t drain_once = PTHREAD_ONCE_INIT;
+// Per thread, like the scheduler whose connections are in it.
+static _Thread_local BLASTER_IDLE *idle_connections;
+
+static void on_drain_signal(int signal_number) {
+    (void)signal_number;
+    drain_requested = 1;
+    // Never read back, so every thread waiting on it keeps seeing it readable.
+    uint64_t one = 1;
+    ssize_t written = write(drain_event_fd, &one, sizeof(one));
+    (void)written;
+}
+
+static void drain_setup(void) {
+    drain_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (drain_event_fd < 0) {
+        perror("Cannot create drain eventfd");
+        return;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_drain_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGQUIT, &action, NULL);
+}
+
+void drain_init(void) {
+    pthread_once(&drain_once, drain_setup);
+    // A supervised worker starts with it blocked; one that arrived since is
+    // delivered now.
+    sigset_t drain_signals;
+    sigemptyset(&drain_signals);
+    sigaddset(&drain_signals, SIGQUIT);
+    pthread_sigmask(SIG_UNBLOCK, &drain_signals, NULL);
+}
+
+int drain_fd(void) {
+    return drain_event_fd;
+}
+
+bool draining(void) {
+    return drain_requested != 0;
+}
+
+void drain_idle_begin(BLASTER_IDLE *idle, int fd) {
+    idle->fd = fd;
+    idle->prev = NULL;
+    idle->next = idle_connections;
+    if (idle_connections != NULL) {
+        idle_connections->prev = idle;
+    }
+    idle_connections = idle;
+}
+
+void drain_idle_end(BLASTER_IDLE *idle) {
+    if (idle->prev != NULL) {
+        idle->prev->next = idle->next;
+    } else if (idle_connections == idle) {
+        idle_connections = idle->next;
+    }
+    if (idle->next != NULL) {
+        idle->next->prev = idle->prev;
+    }
+    idle->next = NULL;
+    idle->prev = NULL;
+}
+
+int drain_close_idle(void) {
+    int closed = 0;
+    // Their coroutines only run once we yield, so the list holds still.
+    for (BLASTER_IDLE *idle = idle_connections; idle != NULL; idle = idle->next) {
+        shutdown(idle->fd, SHUT_RDWR);
+        closed++;
+    }
+    return closed;
+}
+
+int drain_connections(int64_t timeout_ms) {
+    int64_t deadline = now() + timeout_ms;
+    while (blaster_stats.live_connections > 0 && now() < deadline) {
+        msleep(now() + DRAIN_POLL_MS);
+    }
+    return (int)blaster_stats.live_connections;
+}
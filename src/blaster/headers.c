@@ -0,0 +1,109 @@
+#include <string.h>
+#include <strings.h>
+#include <blaster/headers.h>
+
+static const char *well_known_names[HEADERS_WELL_KNOWN] = {
+    [HEADER_HOST] = "host",
+    [HEADER_CONTENT_TYPE] = "content-type",
+    [HEADER_CONTENT_LENGTH] = "content-length",
+    [HEADER_ACCEPT] = "accept",
+    [HEADER_ACCEPT_ENCODING] = "accept-encoding",
+    [HEADER_AUTHORIZATION] = "authorization",
+    [HEADER_COOKIE] = "cookie",
+    [HEADER_IF_NONE_MATCH] = "if-none-match",
+    [HEADER_IF_MODIFIED_SINCE] = "if-modified-since",
+    [HEADER_RANGE] = "range",
+    [HEADER_USER_AGENT] = "user-agent",
+    [HEADER_X_FORWARDED_FOR] = "x-forwarded-for",
+};
+
+// Filled in by headers_init(); read-only once workers run.
+static uint32_t well_known_hashes[HEADERS_WELL_KNOWN];
+
+static uint32_t hash_name(const char *name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        uint8_t c = (uint8_t)name[i];
+        if (c >= 'A' && c <= 'Z') {
+            c |= 0x20;
+        }
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
+
+void headers_init(void) {
+    for (int i = 0; i < HEADERS_WELL_KNOWN; ++i) {
+        well_known_hashes[i] = hash_name(well_known_names[i], strlen(well_known_names[i]));
+    }
+}
+
+void headers_reset(BLASTER_HEADERS *headers) {
+    // Entries past count are never read, so only the bookkeeping is cleared.
+    headers->count = 0;
+    headers->in_name = false;
+    headers->full = false;
+    memset(headers->well_known, 0, sizeof(headers->well_known));
+}
+
+int headers_add_name(BLASTER_HEADERS *headers, size_t offset, size_t length) {
+    if (headers->in_name) {
+        BLASTER_HEADER *header = &headers->entries[headers->count - 1];
+        header->name_length = offset + length - header->name_offset;
+        return 0;
+    }
+    if (headers->count == HEADERS_MAX) {
+        headers->full = true;
+        return -1;
+    }
+    BLASTER_HEADER *header = &headers->entries[headers->count++];
+    header->name_offset = offset;
+    header->name_length = length;
+    header->value_offset = offset + length;
+    header->value_length = 0;
+    headers->in_name = true;
+    return 0;
+}
+
+// The name is complete once its value starts: hash it and give it its slot.
+static void finish_name(BLASTER_HEADERS *headers, const char *buffer) {
+    uint32_t index = headers->count - 1;
+    BLASTER_HEADER *header = &headers->entries[index];
+    header->hash = hash_name(buffer + header->name_offset, header->name_length);
+    for (int i = 0; i < HEADERS_WELL_KNOWN; ++i) {
+        if (well_known_hashes[i] == header->hash && headers->well_known[i] == 0 &&
+                strlen(well_known_names[i]) == header->name_length &&
+                strncasecmp(buffer + header->name_offset, well_known_names[i], header->name_length) == 0) {
+            headers->well_known[i] = index + 1;
+            break;
+        }
+    }
+}
+
+void headers_add_value(BLASTER_HEADERS *headers, const char *buffer, size_t offset, size_t length) {
+    if (headers->count == 0) {
+        return;
+    }
+    BLASTER_HEADER *header = &headers->entries[headers->count - 1];
+    if (headers->in_name) {
+        finish_name(headers, buffer);
+        headers->in_name = false;
+        header->value_offset = offset;
+    }
+    // Pieces of one value are contiguous, except around an obsolete line
+    // fold, which then stays in the value as it was sent.
+    header->value_length = offset + length - header->value_offset;
+}
+
+const BLASTER_HEADER *headers_find(const BLASTER_HEADERS *headers, const char *buffer,
+        const char *name, size_t name_length) {
+    uint32_t hash = hash_name(name, name_length);
+    for (uint32_t i = 0; i < headers->count; ++i) {
+        const BLASTER_HEADER *header = &headers->entries[i];
+        if (header->hash == hash && header->name_length == name_length &&
+                strncasecmp(buffer + header->name_offset, name, name_length) == 0) {
+            return header;
+        }
+    }
+    return NULL;
+}
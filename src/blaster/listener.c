@@ -0,0 +1,127 @@
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <linux/filter.h>
+#include <blaster/listener.h>
+#include <blaster/stats.h>
+
+// libmill's ipaddr is an opaque blob that holds a sockaddr_in or sockaddr_in6.
+static socklen_t address_length(const struct sockaddr *address) {
+    return address->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+int listener_configure(int fd, const BLASTER_LISTENER_OPTIONS *options) {
+    if (options->defer_accept_s > 0
+        && setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &options->defer_accept_s, sizeof(options->defer_accept_s)) != 0) {
+        return -1;
+    }
+    if (options->fastopen_queue > 0
+        && setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &options->fastopen_queue, sizeof(options->fastopen_queue)) != 0) {
+        return -1;
+    }
+    return listen(fd, options->backlog);
+}
+
+int listener_open(ipaddr address, const BLASTER_LISTENER_OPTIONS *options) {
+    const struct sockaddr *socket_address = (const struct sockaddr *)&address;
+    int fd = socket(socket_address->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int enable = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) != 0) {
+        goto error;
+    }
+    if (options->reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) != 0) {
+        goto error;
+    }
+    if (bind(fd, socket_address, address_length(socket_address)) != 0) {
+        goto error;
+    }
+    if (listener_configure(fd, options) != 0) {
+        goto error;
+    }
+    return fd;
+    error: {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+}
+
+void listener_inspect_accepted(int fd, const BLASTER_LISTENER_OPTIONS *options) {
+    if (options->defer_accept_s <= 0 && options->fastopen_queue <= 0) {
+        return;
+    }
+    int pending = 0;
+    if (ioctl(fd, FIONREAD, &pending) == 0 && pending > 0) {
+        blaster_stats.accepted_with_data++;
+    }
+    if (options->fastopen_queue > 0) {
+        struct tcp_info info;
+        socklen_t info_length = sizeof(info);
+        if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &info_length) == 0
+            && (info.tcpi_options & TCPI_OPT_SYN_DATA)) {
+            blaster_stats.accepted_fastopen++;
+        }
+    }
+}
+
+int listener_accept_batch(int fd, int client_fds[], int max_batch) {
+    int accepted = 0;
+    while (accepted < max_batch) {
+        int client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+        client_fds[accepted++] = client_fd;
+    }
+    return accepted;
+}
+
+int listener_wait_set(int fd, int wake_fd) {
+    int wait_set = epoll_create1(EPOLL_CLOEXEC);
+    if (wait_set < 0) {
+        return -1;
+    }
+    int members[] = {fd, wake_fd};
+    for (size_t i = 0; i < sizeof(members) / sizeof(members[0]); ++i) {
+        struct epoll_event event = {.events = EPOLLIN, .data = {.fd = members[i]}};
+        if (epoll_ctl(wait_set, EPOLL_CTL_ADD, members[i], &event) != 0) {
+            int saved_errno = errno;
+            close(wait_set);
+            errno = saved_errno;
+            return -1;
+        }
+    }
+    return wait_set;
+}
+
+int listener_attach_cpu_steering(int fd, int group_size) {
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    // A = cpu; A %= group_size; return A
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)group_size },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog program = {
+        .len = sizeof(code) / sizeof(code[0]),
+        .filter = code,
+    };
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program));
+#else
+    (void)fd;
+    (void)group_size;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
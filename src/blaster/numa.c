@@ -0,0 +1,189 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <blaster/numa.h>
+
+#define NUMA_SYSFS_NODES "/sys/devices/system/node"
+#define NUMA_MAX_NODES 1024
+// From <linux/mempolicy.h>, which needs kernel headers we otherwise don't
+#define NUMA_MPOL_PREFERRED 1
+
+typedef struct BLASTER_NUMA_NODE {
+    int id;
+    int *cpus;
+    int num_cpus;
+} BLASTER_NUMA_NODE;
+
+static int read_line(const char *path, char *buf, size_t buf_length) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    char *line = fgets(buf, buf_length, file);
+    fclose(file);
+    if (line == NULL) {
+        return -1;
+    }
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+static int compare_nodes(const void *left, const void *right) {
+    return ((const BLASTER_NUMA_NODE *)left)->id - ((const BLASTER_NUMA_NODE *)right)->id;
+}
+
+// Nodes with at least one CPU, sorted by id. Memory-only nodes are skipped.
+static int read_nodes(BLASTER_NUMA_NODE **nodes, int *num_nodes) {
+    *nodes = NULL;
+    *num_nodes = 0;
+    DIR *directory = opendir(NUMA_SYSFS_NODES);
+    if (directory == NULL) {
+        return -1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL) {
+        if (strncmp(entry->d_name, "node", 4) != 0 || !isdigit((unsigned char)entry->d_name[4])) {
+            continue;
+        }
+        char path[512];
+        char cpulist[4096];
+        snprintf(path, sizeof(path), NUMA_SYSFS_NODES "/%s/cpulist", entry->d_name);
+        if (read_line(path, cpulist, sizeof(cpulist)) != 0 || cpulist[0] == '\0') {
+            continue;
+        }
+        BLASTER_NUMA_NODE node = {.id = atoi(entry->d_name + 4)};
+        if (parse_cpu_list(cpulist, &node.cpus, &node.num_cpus) != 0) {
+            continue;
+        }
+        BLASTER_NUMA_NODE *grown = realloc(*nodes, sizeof(BLASTER_NUMA_NODE) * (*num_nodes + 1));
+        if (grown == NULL) {
+            free(node.cpus);
+            break;
+        }
+        *nodes = grown;
+        (*nodes)[(*num_nodes)++] = node;
+    }
+    closedir(directory);
+    if (*num_nodes == 0) {
+        return -1;
+    }
+    qsort(*nodes, *num_nodes, sizeof(BLASTER_NUMA_NODE), compare_nodes);
+    return 0;
+}
+
+static int node_of_cpu(const BLASTER_NUMA_NODE nodes[], int num_nodes, int cpu) {
+    for (int i = 0; i < num_nodes; ++i) {
+        for (int j = 0; j < nodes[i].num_cpus; ++j) {
+            if (nodes[i].cpus[j] == cpu) {
+                return nodes[i].id;
+            }
+        }
+    }
+    return -1;
+}
+
+// Node the NIC's PCI device sits on, -1 if unknown (or not a PCI device).
+static int nic_node(const char *interface) {
+    char path[512];
+    char value[32];
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", interface);
+    if (read_line(path, value, sizeof(value)) != 0) {
+        return -1;
+    }
+    return atoi(value);
+}
+
+int numa_plan(BLASTER_OPTIONS *options) {
+    BLASTER_NUMA_NODE *nodes;
+    int num_nodes;
+    if (read_nodes(&nodes, &num_nodes) != 0) {
+        fprintf(stderr, "Cannot read NUMA topology from " NUMA_SYSFS_NODES "\n");
+        return -1;
+    }
+    int local_node = options->numa_nic ? nic_node(options->numa_nic) : -1;
+    if (options->numa_nic && local_node < 0) {
+        fprintf(stderr, "NUMA node of %s is unknown, not favouring any node\n", options->numa_nic);
+    }
+
+    if (options->num_cpus == 0) {
+        // Start with the NIC's node, then deal CPUs out one node at a time.
+        for (int i = 0; i < num_nodes; ++i) {
+            if (nodes[i].id == local_node) {
+                BLASTER_NUMA_NODE first = nodes[i];
+                memmove(&nodes[1], &nodes[0], sizeof(BLASTER_NUMA_NODE) * i);
+                nodes[0] = first;
+                break;
+            }
+        }
+        int total_cpus = 0;
+        int most_cpus = 0;
+        for (int i = 0; i < num_nodes; ++i) {
+            total_cpus += nodes[i].num_cpus;
+            if (nodes[i].num_cpus > most_cpus) {
+                most_cpus = nodes[i].num_cpus;
+            }
+        }
+        options->cpus = malloc(sizeof(int) * total_cpus);
+        if (options->cpus == NULL) {
+            return -1;
+        }
+        for (int round = 0; round < most_cpus; ++round) {
+            for (int i = 0; i < num_nodes; ++i) {
+                if (round < nodes[i].num_cpus) {
+                    options->cpus[options->num_cpus++] = nodes[i].cpus[round];
+                }
+            }
+        }
+    }
+    options->cpu_nodes = malloc(sizeof(int) * options->num_cpus);
+    if (options->cpu_nodes == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < options->num_cpus; ++i) {
+        options->cpu_nodes[i] = node_of_cpu(nodes, num_nodes, options->cpus[i]);
+    }
+
+    int num_workers = options_num_workers(options);
+    printf("NUMA layout: %d node(s)", num_nodes);
+    if (local_node >= 0) {
+        printf(", %s on node %d", options->numa_nic, local_node);
+    }
+    printf("\n");
+    for (int i = 0; i < num_nodes; ++i) {
+        printf("  node %d (%d cpu(s)): workers", nodes[i].id, nodes[i].num_cpus);
+        for (int worker = 0; worker < num_workers; ++worker) {
+            if (options->cpu_nodes[worker % options->num_cpus] == nodes[i].id) {
+                printf(" %d", worker);
+            }
+        }
+        printf("\n");
+    }
+    for (int worker = 0; worker < num_workers; ++worker) {
+        int node = options->cpu_nodes[worker % options->num_cpus];
+        printf("  worker %d: cpu %d, memory on node %d%s\n", worker,
+            options->cpus[worker % options->num_cpus], node,
+            local_node >= 0 && node == local_node ? ", NIC local" : "");
+    }
+    fflush(stdout);
+
+    for (int i = 0; i < num_nodes; ++i) {
+        free(nodes[i].cpus);
+    }
+    free(nodes);
+    return 0;
+}
+
+int numa_bind_memory(int node) {
+    if (node < 0 || node >= NUMA_MAX_NODES) {
+        errno = EINVAL;
+        return -1;
+    }
+    unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    return (int)syscall(SYS_set_mempolicy, NUMA_MPOL_PREFERRED, mask, (unsigned long)NUMA_MAX_NODES + 1);
+}
@@ -0,0 +1,449 @@
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <blaster/buffer_pool.h>
+#include <blaster/options.h>
+#include <blaster/stack_calibration.h>
+
+enum {
+    OPTION_REUSEPORT = 256,
+    OPTION_CPU_STEERING,
+    OPTION_ACCEPT_BATCH,
+    OPTION_MAX_CONNECTIONS,
+    OPTION_RESUME_CONNECTIONS,
+    OPTION_SUPERVISE,
+    OPTION_DRAIN_TIMEOUT,
+    OPTION_COROUTINES,
+    OPTION_STACK_SIZE,
+    OPTION_VALUE_SIZE,
+    OPTION_CALIBRATE_STACKS,
+    OPTION_SHED_TARGET,
+    OPTION_SHED_INTERVAL,
+    OPTION_DEFER_ACCEPT,
+    OPTION_FASTOPEN,
+    OPTION_NUMA,
+    OPTION_NUMA_NIC,
+    OPTION_MAX_REQUESTS,
+    OPTION_MAX_BUFFER_SIZE,
+    OPTION_MAX_HEADER_SIZE,
+    OPTION_HEADER_TIMEOUT,
+    OPTION_BODY_TIMEOUT,
+    OPTION_IDLE_TIMEOUT,
+    OPTION_SEND_TIMEOUT,
+    OPTION_MIN_DATA_RATE,
+    OPTION_MIN_DATA_RATE_GRACE,
+    OPTION_SPILL_THRESHOLD,
+    OPTION_SPILL_DIR,
+};
+
+static const struct option long_options[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"port", required_argument, NULL, 'p'},
+    {"processes", required_argument, NULL, 'n'},
+    {"threads", required_argument, NULL, 't'},
+    {"reuseport", no_argument, NULL, OPTION_REUSEPORT},
+    {"cpu-steering", no_argument, NULL, OPTION_CPU_STEERING},
+    {"accept-batch", required_argument, NULL, OPTION_ACCEPT_BATCH},
+    {"backlog", required_argument, NULL, 'b'},
+    {"max-connections", required_argument, NULL, OPTION_MAX_CONNECTIONS},
+    {"resume-connections", required_argument, NULL, OPTION_RESUME_CONNECTIONS},
+    {"supervise", no_argument, NULL, OPTION_SUPERVISE},
+    {"cpus", required_argument, NULL, 'c'},
+    {"drain-timeout", required_argument, NULL, OPTION_DRAIN_TIMEOUT},
+    {"coroutines", required_argument, NULL, OPTION_COROUTINES},
+    {"stack-size", required_argument, NULL, OPTION_STACK_SIZE},
+    {"value-size", required_argument, NULL, OPTION_VALUE_SIZE},
+    {"calibrate-stacks", no_argument, NULL, OPTION_CALIBRATE_STACKS},
+    {"shed-target-ms", required_argument, NULL, OPTION_SHED_TARGET},
+    {"shed-interval-ms", required_argument, NULL, OPTION_SHED_INTERVAL},
+    {"defer-accept", required_argument, NULL, OPTION_DEFER_ACCEPT},
+    {"fastopen", required_argument, NULL, OPTION_FASTOPEN},
+    {"numa", no_argument, NULL, OPTION_NUMA},
+    {"numa-nic", required_argument, NULL, OPTION_NUMA_NIC},
+    {"max-requests", required_argument, NULL, OPTION_MAX_REQUESTS},
+    {"max-buffer-size", required_argument, NULL, OPTION_MAX_BUFFER_SIZE},
+    {"max-header-size", required_argument, NULL, OPTION_MAX_HEADER_SIZE},
+    {"header-timeout", required_argument, NULL, OPTION_HEADER_TIMEOUT},
+    {"body-timeout", required_argument, NULL, OPTION_BODY_TIMEOUT},
+    {"idle-timeout", required_argument, NULL, OPTION_IDLE_TIMEOUT},
+    {"send-timeout", required_argument, NULL, OPTION_SEND_TIMEOUT},
+    {"min-data-rate", required_argument, NULL, OPTION_MIN_DATA_RATE},
+    {"min-data-rate-grace", required_argument, NULL, OPTION_MIN_DATA_RATE_GRACE},
+    {"spill-threshold", required_argument, NULL, OPTION_SPILL_THRESHOLD},
+    {"spill-dir", required_argument, NULL, OPTION_SPILL_DIR},
+    {NULL, 0, NULL, 0}
+};
+
+void print_usage(FILE *stream, const char *program) {
+    fprintf(stream,
+        "Usage: %s [flags] [port [num_processes]]\n"
+        "  -p, --port PORT          port to listen on (default 5555)\n"
+        "  -n, --processes N        number of worker processes (default 1)\n"
+        "  -t, --threads N          run N worker threads in one process instead, each\n"
+        "                           with its own scheduler and listener\n"
+        "      --reuseport          one SO_REUSEPORT listener per worker\n"
+        "      --cpu-steering       steer connections to the worker pinned to the\n"
+        "                           CPU that received them (implies --reuseport)\n"
+        "      --accept-batch N     most connections accepted per wakeup (default 64)\n"
+        "  -b, --backlog N          listen backlog (default SOMAXCONN)\n"
+        "      --defer-accept S     TCP_DEFER_ACCEPT: only wake us for connections\n"
+        "                           that sent data, waiting up to S seconds\n"
+        "      --fastopen QLEN      enable TCP Fast Open with a queue of QLEN\n"
+        "      --max-connections N  stop accepting at N live connections (default 0,\n"
+        "                           unlimited)\n"
+        "      --resume-connections N\n"
+        "                           accept again once down to N live connections\n"
+        "                           (default 90%% of --max-connections)\n"
+        "      --max-requests N     requests served on one keep-alive connection\n"
+        "                           (default 40, 0 for no limit)\n"
+        "      --max-buffer-size BYTES\n"
+        "                           largest a connection's read buffer grows to hold\n"
+        "                           a request's headers (default 65536)\n"
+        "      --max-header-size BYTES\n"
+        "                           largest a request line and headers may be, as\n"
+        "                           counted by the parser (default 65536)\n"
+        "      --header-timeout S   seconds to receive a request's headers, from\n"
+        "                           accept or its first byte (default 10)\n"
+        "      --body-timeout S     seconds to receive a request's body (default 10)\n"
+        "      --idle-timeout S     seconds a keep-alive connection may wait for its\n"
+        "                           next request (default 5)\n"
+        "      --send-timeout S     seconds to send a response (default 10)\n"
+        "      --min-data-rate BYTES\n"
+        "                           close connections sending headers or a body\n"
+        "                           slower than BYTES per second (default 0, off)\n"
+        "      --min-data-rate-grace S\n"
+        "                           seconds before the rate is enforced (default 2)\n"
+        "      --spill-threshold BYTES\n"
+        "                           bodies collected for a route are moved to a temp\n"
+        "                           file past this size (default 65536)\n"
+        "      --spill-dir DIR      where those temp files go (default /tmp)\n"
+        "      --supervise          run a master that restarts dead workers even with\n"
+        "                           a single worker (implied by -n > 1)\n"
+        "  -c, --cpus LIST          pin worker N to the Nth CPU of LIST, e.g. 0-3,8\n"
+        "      --numa               spread workers across NUMA nodes and keep their\n"
+        "                           memory on their own node\n"
+        "      --numa-nic IFACE     place workers on IFACE's node first (implies\n"
+        "                           --numa)\n"
+        "      --drain-timeout S    seconds a draining worker waits for its\n"
+        "                           connections (default 30)\n"
+        "      --coroutines N       coroutines preallocated per worker (default 1000)\n"
+        "      --stack-size BYTES   stack size of every coroutine (default 100000)\n"
+        "      --value-size BYTES   largest channel value (default 128)\n"
+        "      --calibrate-stacks   measure the stack high-water mark of every\n"
+        "                           connection and report it in /stats\n"
+        "      --shed-target-ms MS  answer new connections with 503 while the time\n"
+        "                           from accept to parsing stays above MS (default 0,\n"
+        "                           off)\n"
+        "      --shed-interval-ms MS\n"
+        "                           how long it has to stay above (default 100)\n"
+        "  -h, --help               show this message\n",
+        program);
+}
+
+int parse_options(int arg_count, char* args[], BLASTER_OPTIONS *options) {
+    memset(options, 0, sizeof(*options));
+    options->port = 5555;
+    options->num_processes = 1;
+    options->num_threads = 1;
+    options->accept_batch = 64;
+    options->listener.backlog = SOMAXCONN;
+    options->resume_connections = -1;
+    options->max_requests = 40;
+    options->max_buffer_size = 65536;
+    options->max_header_size = 65536;
+    options->header_timeout_ms = 10 * 1000;
+    options->body_timeout_ms = 10 * 1000;
+    options->idle_timeout_ms = 5 * 1000;
+    options->send_timeout_ms = 10 * 1000;
+    options->min_data_rate_grace_ms = 2 * 1000;
+    options->spill_threshold = 65536;
+    options->spill_directory = "/tmp";
+    options->drain_timeout_ms = 30 * 1000;
+    options->coroutines = 1000;
+    options->stack_size = 100000;
+    options->value_size = 128;
+    options->shed_interval_ms = 100;
+    options->args = args;
+
+    int option;
+    while ((option = getopt_long(arg_count, args, "hp:n:t:b:c:", long_options, NULL)) != -1) {
+        switch (option) {
+            case 'h':
+                print_usage(stdout, args[0]);
+                return -1;
+            case 'p':
+                options->port = atoi(optarg);
+                break;
+            case 'n':
+                options->num_processes = atoi(optarg);
+                break;
+            case 't':
+                options->num_threads = atoi(optarg);
+                break;
+            case OPTION_REUSEPORT:
+                options->reuseport = true;
+                break;
+            case OPTION_CPU_STEERING:
+                options->cpu_steering = true;
+                options->reuseport = true;
+                break;
+            case OPTION_ACCEPT_BATCH:
+                options->accept_batch = atoi(optarg);
+                break;
+            case 'b':
+                options->listener.backlog = atoi(optarg);
+                break;
+            case OPTION_MAX_CONNECTIONS:
+                options->max_connections = atoi(optarg);
+                break;
+            case OPTION_RESUME_CONNECTIONS:
+                options->resume_connections = atoi(optarg);
+                break;
+            case OPTION_MAX_REQUESTS:
+                options->max_requests = atoi(optarg);
+                break;
+            case OPTION_MAX_BUFFER_SIZE:
+                options->max_buffer_size = strtoul(optarg, NULL, 10);
+                break;
+            case OPTION_MAX_HEADER_SIZE:
+                options->max_header_size = strtoul(optarg, NULL, 10);
+                break;
+            case OPTION_HEADER_TIMEOUT:
+                options->header_timeout_ms = atoi(optarg) * 1000LL;
+                break;
+            case OPTION_BODY_TIMEOUT:
+                options->body_timeout_ms = atoi(optarg) * 1000LL;
+                break;
+            case OPTION_IDLE_TIMEOUT:
+                options->idle_timeout_ms = atoi(optarg) * 1000LL;
+                break;
+            case OPTION_SEND_TIMEOUT:
+                options->send_timeout_ms = atoi(optarg) * 1000LL;
+                break;
+            case OPTION_MIN_DATA_RATE:
+                options->min_data_rate = atoi(optarg);
+                break;
+            case OPTION_MIN_DATA_RATE_GRACE:
+                options->min_data_rate_grace_ms = atoi(optarg) * 1000LL;
+                break;
+            case OPTION_SPILL_THRESHOLD:
+                options->spill_threshold = strtoul(optarg, NULL, 10);
+                break;
+            case OPTION_SPILL_DIR:
+                options->spill_directory = optarg;
+                break;
+            case OPTION_SUPERVISE:
+                options->supervise = true;
+                break;
+            case 'c':
+                free(options->cpus);
+                if (parse_cpu_list(optarg, &options->cpus, &options->num_cpus) != 0) {
+                    fprintf(stderr, "Invalid CPU list: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_DRAIN_TIMEOUT:
+                options->drain_timeout_ms = atoi(optarg) * 1000LL;
+                break;
+            case OPTION_COROUTINES:
+                options->coroutines = atoi(optarg);
+                break;
+            case OPTION_STACK_SIZE:
+                options->stack_size = strtoul(optarg, NULL, 10);
+                break;
+            case OPTION_VALUE_SIZE:
+                options->value_size = strtoul(optarg, NULL, 10);
+                break;
+            case OPTION_CALIBRATE_STACKS:
+                options->calibrate_stacks = true;
+                break;
+            case OPTION_SHED_TARGET:
+                options->shed_target_ms = atoi(optarg);
+                break;
+            case OPTION_SHED_INTERVAL:
+                options->shed_interval_ms = atoi(optarg);
+                break;
+            case OPTION_DEFER_ACCEPT:
+                options->listener.defer_accept_s = atoi(optarg);
+                break;
+            case OPTION_FASTOPEN:
+                options->listener.fastopen_queue = atoi(optarg);
+                break;
+            case OPTION_NUMA:
+                options->numa = true;
+                break;
+            case OPTION_NUMA_NIC:
+                options->numa = true;
+                options->numa_nic = optarg;
+                break;
+            default:
+                print_usage(stderr, args[0]);
+                return 1;
+        }
+    }
+    // Positional arguments from before we had flags.
+    if (optind < arg_count) {
+        options->port = atoi(args[optind++]);
+    }
+    if (optind < arg_count) {
+        options->num_processes = atoi(args[optind++]);
+    }
+
+    if (options->port < 1) {
+        fprintf(stderr, "Ports cannot be less than 1\n");
+        return 1;
+    }
+    if (options->num_processes < 1) {
+        fprintf(stderr, "Num processes cannot be less than 1\n");
+        return 2;
+    }
+    if (options->accept_batch < 1) {
+        fprintf(stderr, "Accept batch cannot be less than 1\n");
+        return 1;
+    }
+    if (options->listener.backlog < 1) {
+        fprintf(stderr, "Backlog cannot be less than 1\n");
+        return 1;
+    }
+    if (options->max_connections < 0) {
+        fprintf(stderr, "Max connections cannot be negative\n");
+        return 1;
+    }
+    if (options->resume_connections < 0) {
+        options->resume_connections = options->max_connections - options->max_connections / 10;
+        // For a max below 10 that is the max itself, one too many.
+        if (options->max_connections > 0 && options->resume_connections >= options->max_connections) {
+            options->resume_connections = options->max_connections - 1;
+        }
+    }
+    if (options->max_connections > 0 && options->resume_connections >= options->max_connections) {
+        fprintf(stderr, "Resume connections must be below max connections\n");
+        return 1;
+    }
+    if (options->max_requests < 0) {
+        fprintf(stderr, "Max requests cannot be negative\n");
+        return 1;
+    }
+    if (options->max_buffer_size < BUFFER_POOL_BUFFER_SIZE) {
+        fprintf(stderr, "Max buffer size cannot be less than %d bytes\n", BUFFER_POOL_BUFFER_SIZE);
+        return 1;
+    }
+    if (options->max_header_size == 0) {
+        fprintf(stderr, "Max header size must be at least 1 byte\n");
+        return 1;
+    }
+    if (options->header_timeout_ms < 1000 || options->body_timeout_ms < 1000 ||
+            options->idle_timeout_ms < 1000 || options->send_timeout_ms < 1000) {
+        fprintf(stderr, "Timeouts must be at least 1 second\n");
+        return 1;
+    }
+    if (options->min_data_rate < 0 || options->min_data_rate_grace_ms < 0) {
+        fprintf(stderr, "Min data rate and its grace period cannot be negative\n");
+        return 1;
+    }
+    if (options->num_threads < 1) {
+        fprintf(stderr, "Num threads cannot be less than 1\n");
+        return 2;
+    }
+    if (options->num_threads > 1) {
+        if (options->num_processes > 1 || options->supervise) {
+            fprintf(stderr, "--threads runs a single process and cannot be combined with -n or --supervise\n");
+            return 2;
+        }
+        // Shared-nothing: every thread accepts from a listener of its own.
+        options->reuseport = true;
+    }
+    if (options->coroutines < 0) {
+        fprintf(stderr, "Coroutines cannot be negative\n");
+        return 1;
+    }
+    if (options->calibrate_stacks && options->stack_size <= 2 * STACK_CALIBRATION_RESERVE) {
+        fprintf(stderr, "--calibrate-stacks needs a stack size above %d bytes\n", 2 * STACK_CALIBRATION_RESERVE);
+        return 1;
+    }
+    if (options->shed_target_ms < 0 || options->shed_interval_ms < 1) {
+        fprintf(stderr, "Invalid load shedding target or interval\n");
+        return 1;
+    }
+    if (options->listener.defer_accept_s < 0 || options->listener.fastopen_queue < 0) {
+        fprintf(stderr, "Defer accept and fastopen queue cannot be negative\n");
+        return 1;
+    }
+    if (options->num_processes > 1) {
+        options->supervise = true;
+    }
+    options->listener.reuseport = options->reuseport;
+    int num_workers = options_num_workers(options);
+    if (options->cpu_steering && options->num_cpus == 0) {
+        // The steering program sends CPU N's connections to listener N.
+        options->cpus = malloc(sizeof(int) * num_workers);
+        if (options->cpus == NULL) {
+            return 1;
+        }
+        for (int i = 0; i < num_workers; ++i) {
+            options->cpus[i] = i;
+        }
+        options->num_cpus = num_workers;
+    } else if (options->cpu_steering) {
+        // An explicit list has to agree with that: the worker that gets CPU N's
+        // connections must be the one pinned to CPU N.
+        for (int i = 0; i < num_workers; ++i) {
+            int cpu = options->cpus[i % options->num_cpus];
+            if (cpu % num_workers != i) {
+                fprintf(stderr, "--cpu-steering needs worker N pinned to a CPU that is N modulo %d workers, "
+                    "but worker %d is on CPU %d\n", num_workers, i, cpu);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int parse_cpu_list(const char *list, int **cpus, int *num_cpus) {
+    *cpus = NULL;
+    *num_cpus = 0;
+    int capacity = 0;
+    const char *position = list;
+    while (*position) {
+        char *end;
+        long first = strtol(position, &end, 10);
+        if (end == position || first < 0) {
+            goto error;
+        }
+        long last = first;
+        if (*end == '-') {
+            position = end + 1;
+            last = strtol(position, &end, 10);
+            if (end == position || last < first) {
+                goto error;
+            }
+        }
+        for (long cpu = first; cpu <= last; ++cpu) {
+            if (*num_cpus == capacity) {
+                capacity = capacity ? capacity * 2 : 16;
+                int *grown = realloc(*cpus, sizeof(int) * capacity);
+                if (grown == NULL) {
+                    goto error;
+                }
+                *cpus = grown;
+            }
+            (*cpus)[(*num_cpus)++] = (int)cpu;
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            goto error;
+        }
+        position = end;
+    }
+    if (*num_cpus == 0) {
+        goto error;
+    }
+    return 0;
+    error:
+        free(*cpus);
+        *cpus = NULL;
+        *num_cpus = 0;
+        return -1;
+}
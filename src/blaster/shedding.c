@@ -0,0 +1,65 @@
+#include <libmill.h>
+#include <math.h>
+#include <blaster/shedding.h>
+#include <blaster/stats.h>
+
+typedef struct BLASTER_SHEDDING {
+    int64_t target_ms;
+    int64_t interval_ms;
+    // When the sojourn time will have been above target for an interval,
+    // 0 while it is below target
+    int64_t first_above_time;
+    bool dropping;
+    int64_t drop_next;
+    uint32_t count;
+} BLASTER_SHEDDING;
+
+static _Thread_local BLASTER_SHEDDING shedding;
+
+void shedding_init(int64_t target_ms, int64_t interval_ms) {
+    shedding = (BLASTER_SHEDDING){.target_ms = target_ms, .interval_ms = interval_ms};
+}
+
+// CoDel's control law: the time between sheds shrinks as interval/sqrt(count).
+static int64_t control_law(int64_t from, uint32_t count) {
+    return from + (int64_t)(shedding.interval_ms / sqrt((double)count));
+}
+
+bool shedding_should_shed(int64_t sojourn_ms) {
+    if (shedding.target_ms <= 0) {
+        return false;
+    }
+    int64_t current_time = now();
+    blaster_stats.sojourn_last_ms = sojourn_ms;
+
+    if (sojourn_ms < shedding.target_ms) {
+        shedding.first_above_time = 0;
+        shedding.dropping = false;
+        blaster_stats.shedding = 0;
+        return false;
+    }
+    if (shedding.first_above_time == 0) {
+        shedding.first_above_time = current_time + shedding.interval_ms;
+        return false;
+    }
+    if (!shedding.dropping) {
+        if (current_time < shedding.first_above_time) {
+            return false;
+        }
+        shedding.dropping = true;
+        blaster_stats.shedding = 1;
+        // Pick up near the rate we were shedding at if we only just stopped.
+        shedding.count = (shedding.count > 2 && current_time - shedding.drop_next < 16 * shedding.interval_ms)
+            ? shedding.count - 2 : 1;
+        shedding.drop_next = control_law(current_time, shedding.count);
+        blaster_stats.shed_requests++;
+        return true;
+    }
+    if (current_time < shedding.drop_next) {
+        return false;
+    }
+    shedding.count++;
+    shedding.drop_next = control_law(shedding.drop_next, shedding.count);
+    blaster_stats.shed_requests++;
+    return true;
+}
@@ -0,0 +1,41 @@
+#include <stdint.h>
+#include <blaster/stack_calibration.h>
+#include <blaster/stats.h>
+
+#define STACK_PAINT_PATTERN 0xA5
+// Painting starts this far below base so stack_paint() doesn't paint over
+// its own frame (or stack_measure() read back its own).
+#define STACK_PAINT_SKIP 1024
+#define STACK_PAGE_SIZE 4096
+
+__attribute__((noinline)) void stack_paint(volatile char *base, size_t paint_bytes) {
+    volatile char *top = base - STACK_PAINT_SKIP;
+    for (volatile char *position = base - paint_bytes; position < top; ++position) {
+        *position = (char)STACK_PAINT_PATTERN;
+    }
+}
+
+__attribute__((noinline)) size_t stack_measure(volatile char *base, size_t paint_bytes) {
+    volatile char *top = base - STACK_PAINT_SKIP;
+    volatile char *position = base - paint_bytes;
+    while (position < top && (unsigned char)*position == STACK_PAINT_PATTERN) {
+        ++position;
+    }
+    return (size_t)(base - position);
+}
+
+void stack_record(size_t used_bytes) {
+    blaster_stats.stack_samples++;
+    if (used_bytes > blaster_stats.stack_high_water) {
+        blaster_stats.stack_high_water = used_bytes;
+    }
+}
+
+size_t stack_suggested_size(void) {
+    if (blaster_stats.stack_samples == 0) {
+        return 0;
+    }
+    // Half again the deepest use plus what we never painted, to a page.
+    size_t suggested = blaster_stats.stack_high_water + blaster_stats.stack_high_water / 2 + STACK_CALIBRATION_RESERVE;
+    return (suggested + STACK_PAGE_SIZE - 1) / STACK_PAGE_SIZE * STACK_PAGE_SIZE;
+}
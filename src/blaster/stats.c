@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <blaster/stack_calibration.h>
+#include <blaster/stats.h>
+
+_Thread_local BLASTER_STATS blaster_stats;
+
+size_t stats_format(char *buf, size_t buf_length) {
+    const BLASTER_STATS *stats = &blaster_stats;
+    double per_wakeup = 0;
+    if (stats->accept_wakeups > 0) {
+        per_wakeup = (double)stats->accepted / (double)stats->accept_wakeups;
+    }
+    int written = snprintf(buf, buf_length,
+        "accept_wakeups %" PRIu64 "\n"
+        "accept_empty_wakeups %" PRIu64 "\n"
+        "accepted %" PRIu64 "\n"
+        "accept_max_batch %" PRIu64 "\n"
+        "accepts_per_wakeup %.2f\n"
+        "live_connections %" PRIu64 "\n"
+        "admission_pauses %" PRIu64 "\n"
+        "stack_high_water %" PRIu64 "\n"
+        "stack_samples %" PRIu64 "\n"
+        "stack_suggested_size %zu\n"
+        "shed_requests %" PRIu64 "\n"
+        "shedding %" PRIu64 "\n"
+        "sojourn_last_ms %" PRId64 "\n"
+        "accepted_with_data %" PRIu64 "\n"
+        "accepted_fastopen %" PRIu64 "\n"
+        "connections_empty %" PRIu64 "\n"
+        "requests_pipelined %" PRIu64 "\n"
+        "buffers_pooled %" PRIu64 "\n"
+        "buffers_in_use %" PRIu64 "\n"
+        "buffers_grown %" PRIu64 "\n"
+        "drops_header_timeout %" PRIu64 "\n"
+        "drops_body_timeout %" PRIu64 "\n"
+        "drops_send_timeout %" PRIu64 "\n"
+        "drops_slow_headers %" PRIu64 "\n"
+        "drops_slow_body %" PRIu64 "\n"
+        "idle_timeouts %" PRIu64 "\n"
+        "bodies_spilled %" PRIu64 "\n"
+        "bodies_skipped %" PRIu64 "\n"
+        "body_bytes_skipped %" PRIu64 "\n",
+        stats->accept_wakeups,
+        stats->accept_empty_wakeups,
+        stats->accepted,
+        stats->accept_max_batch,
+        per_wakeup,
+        stats->live_connections,
+        stats->admission_pauses,
+        stats->stack_high_water,
+        stats->stack_samples,
+        stack_suggested_size(),
+        stats->shed_requests,
+        stats->shedding,
+        stats->sojourn_last_ms,
+        stats->accepted_with_data,
+        stats->accepted_fastopen,
+        stats->connections_empty,
+        stats->requests_pipelined,
+        stats->buffers_pooled,
+        stats->buffers_in_use,
+        stats->buffers_grown,
+        stats->drops_header_timeout,
+        stats->drops_body_timeout,
+        stats->drops_send_timeout,
+        stats->drops_slow_headers,
+        stats->drops_slow_body,
+        stats->idle_timeouts,
+        stats->bodies_spilled,
+        stats->bodies_skipped,
+        stats->body_bytes_skipped);
+    if (written < 0) {
+        return 0;
+    }
+    return (size_t)written < buf_length ? (size_t)written : buf_length - 1;
+}
@@ -0,0 +1,361 @@
+#include <libmill.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <blaster/debug.h>
+#include <blaster/supervisor.h>
+#include <blaster/upgrade.h>
+
+int pin_to_cpu(int cpu) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    return sched_setaffinity(0, sizeof(cpu_set), &cpu_set);
+}
+
+static void describe_status(int status, char *buf, size_t buf_length) {
+    if (status < 0) {
+        snprintf(buf, buf_length, "-");
+    } else if (WIFSIGNALED(status)) {
+        snprintf(buf, buf_length, "signal %d (%s)", WTERMSIG(status), strsignal(WTERMSIG(status)));
+    } else {
+        snprintf(buf, buf_length, "exit %d", WEXITSTATUS(status));
+    }
+}
+
+static void print_workers(const BLASTER_WORKER workers[], int num_workers) {
+    int64_t current_time = now();
+    printf("[master %i] %d worker(s)\n", getpid(), num_workers);
+    for (int i = 0; i < num_workers; ++i) {
+        const BLASTER_WORKER *worker = &workers[i];
+        char last_exit[64];
+        describe_status(worker->last_status, last_exit, sizeof(last_exit));
+        if (worker->pid > 0) {
+            printf("  worker %d: pid %i, cpu %d, up %lld ms, %d restart(s), last exit %s\n",
+                worker->index, worker->pid, worker->cpu,
+                (long long)(current_time - worker->started_at), worker->restarts, last_exit);
+        } else if (worker->respawn_at < 0) {
+            printf("  worker %d: stopped, cpu %d, %d restart(s), last exit %s\n",
+                worker->index, worker->cpu, worker->restarts, last_exit);
+        } else {
+            printf("  worker %d: restarting in %lld ms, cpu %d, %d restart(s), last exit %s\n",
+                worker->index, (long long)(worker->respawn_at - current_time), worker->cpu,
+                worker->restarts, last_exit);
+        }
+    }
+    fflush(stdout);
+}
+
+typedef struct BLASTER_SUPERVISOR {
+    const BLASTER_OPTIONS *options;
+    const int *listeners;
+    int num_listeners;
+    worker_main_fn worker_main;
+    // Signal mask workers run with (the master blocks what it waits for)
+    sigset_t worker_signal_mask;
+    // Write end of the pipe workers check in on while we start up, -1 after
+    int ready_fd;
+} BLASTER_SUPERVISOR;
+
+// Set in a worker while it still owes the master a ready notification.
+static int worker_ready_fd = -1;
+
+void supervisor_worker_ready(void) {
+    if (worker_ready_fd < 0) {
+        return;
+    }
+    char ready = 1;
+    ssize_t written = write(worker_ready_fd, &ready, sizeof(ready));
+    (void)written;
+    close(worker_ready_fd);
+    worker_ready_fd = -1;
+}
+
+static int spawn_worker(BLASTER_SUPERVISOR *supervisor, BLASTER_WORKER *worker) {
+    // Don't let the child inherit (and later repeat) whatever is buffered.
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = mfork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        // SIGQUIT stays blocked until drain_init() has a handler for it, so
+        // a worker retired right after it was spawned drains instead of
+        // dumping core.
+        sigset_t worker_signals = supervisor->worker_signal_mask;
+        sigaddset(&worker_signals, SIGQUIT);
+        sigprocmask(SIG_SETMASK, &worker_signals, NULL);
+        for (int i = 0; i < supervisor->num_listeners; ++i) {
+            if (supervisor->listeners[i] != worker->listen_fd) {
+                close(supervisor->listeners[i]);
+            }
+        }
+        worker_ready_fd = supervisor->ready_fd;
+        if (worker->cpu >= 0 && pin_to_cpu(worker->cpu) != 0) {
+            fprintf(stderr, "[%i] Cannot pin worker %d to CPU %d: %s\n",
+                getpid(), worker->index, worker->cpu, strerror(errno));
+        }
+        exit(supervisor->worker_main(supervisor->options, worker->index, worker->listen_fd));
+    }
+    worker->pid = pid;
+    worker->started_at = now();
+    worker->respawn_at = 0;
+    return 0;
+}
+
+// Waits (up to UPGRADE_READY_TIMEOUT_MS) for the first set of workers to
+// call supervisor_worker_ready(), then stops listening for them.
+static int wait_for_workers(BLASTER_SUPERVISOR *supervisor, int ready_pipe, int num_workers) {
+    close(supervisor->ready_fd);
+    supervisor->ready_fd = -1;
+    int num_ready = 0;
+    int64_t deadline = now() + UPGRADE_READY_TIMEOUT_MS;
+    while (num_ready < num_workers) {
+        int64_t wait_ms = deadline - now();
+        struct pollfd wait_for = {.fd = ready_pipe, .events = POLLIN};
+        if (wait_ms <= 0 || poll(&wait_for, 1, (int)wait_ms) == 0) {
+            break;
+        }
+        char ready[64];
+        ssize_t num_read = read(ready_pipe, ready, sizeof(ready));
+        if (num_read == 0 || (num_read < 0 && errno != EINTR)) {
+            // Every worker has either checked in or died.
+            break;
+        }
+        if (num_read > 0) {
+            num_ready += num_read;
+        }
+    }
+    close(ready_pipe);
+    return num_ready;
+}
+
+// Collects every exited worker and, unless we are retiring, schedules its
+// respawn. Returns how many workers are still running.
+static int reap_workers(BLASTER_WORKER workers[], int num_workers, bool retiring) {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (int i = 0; i < num_workers; ++i) {
+            BLASTER_WORKER *worker = &workers[i];
+            if (worker->pid != pid) {
+                continue;
+            }
+            int64_t current_time = now();
+            if (current_time - worker->started_at >= WORKER_STABLE_MS) {
+                worker->backoff_ms = RESPAWN_BACKOFF_MIN_MS;
+            }
+            int64_t delay_ms = worker->backoff_ms;
+            worker->backoff_ms *= 2;
+            if (worker->backoff_ms > RESPAWN_BACKOFF_MAX_MS) {
+                worker->backoff_ms = RESPAWN_BACKOFF_MAX_MS;
+            }
+            char last_exit[64];
+            describe_status(status, last_exit, sizeof(last_exit));
+            worker->pid = 0;
+            worker->last_status = status;
+            if (retiring) {
+                worker->respawn_at = -1;
+                DEBUG_PRINTF("[master %i] Worker %d (pid %i) finished with %s\n",
+                    getpid(), worker->index, pid, last_exit);
+                continue;
+            }
+            fprintf(stderr, "[master %i] Worker %d (pid %i) died with %s, restarting in %lld ms\n",
+                getpid(), worker->index, pid, last_exit, (long long)delay_ms);
+            worker->respawn_at = current_time + delay_ms;
+        }
+    }
+    int running = 0;
+    for (int i = 0; i < num_workers; ++i) {
+        if (workers[i].pid > 0) {
+            running++;
+        }
+    }
+    return running;
+}
+
+// Asks every worker to drain and stops respawning any of them.
+static void retire_workers(BLASTER_WORKER workers[], int num_workers) {
+    for (int i = 0; i < num_workers; ++i) {
+        if (workers[i].pid > 0) {
+            kill(workers[i].pid, SIGQUIT);
+        } else {
+            workers[i].respawn_at = -1;
+        }
+    }
+}
+
+static void stop_workers(BLASTER_WORKER workers[], int num_workers) {
+    for (int i = 0; i < num_workers; ++i) {
+        if (workers[i].pid > 0) {
+            kill(workers[i].pid, SIGTERM);
+        }
+    }
+    // Only our workers: after an upgrade the next generation's master is a
+    // child of ours too, and it is not ours to wait for.
+    for (int i = 0; i < num_workers; ++i) {
+        if (workers[i].pid <= 0) {
+            continue;
+        }
+        while (waitpid(workers[i].pid, NULL, 0) < 0 && errno == EINTR) {
+        }
+        workers[i].pid = 0;
+    }
+}
+
+int supervise(const BLASTER_OPTIONS *options, const int listeners[], int num_listeners, worker_main_fn worker_main) {
+    int num_workers = options->num_processes;
+    BLASTER_WORKER workers[num_workers];
+    memset(workers, 0, sizeof(workers));
+    for (int i = 0; i < num_workers; ++i) {
+        workers[i].index = i;
+        workers[i].cpu = options->num_cpus > 0 ? options->cpus[i % options->num_cpus] : -1;
+        workers[i].listen_fd = listeners[num_listeners > 1 ? i : 0];
+        workers[i].backoff_ms = RESPAWN_BACKOFF_MIN_MS;
+        workers[i].last_status = -1;
+    }
+    BLASTER_SUPERVISOR supervisor = {
+        .options = options,
+        .listeners = listeners,
+        .num_listeners = num_listeners,
+        .worker_main = worker_main,
+        .ready_fd = -1,
+    };
+
+    // Everything the master reacts to is taken synchronously with
+    // sigtimedwait(), so the signals stay blocked outside of it.
+    sigset_t master_signals;
+    sigemptyset(&master_signals);
+    sigaddset(&master_signals, SIGCHLD);
+    sigaddset(&master_signals, SIGUSR1);
+    sigaddset(&master_signals, SIGUSR2);
+    sigaddset(&master_signals, SIGQUIT);
+    sigaddset(&master_signals, SIGTERM);
+    sigaddset(&master_signals, SIGINT);
+    sigprocmask(SIG_BLOCK, &master_signals, &supervisor.worker_signal_mask);
+
+    int ready_pipe[2];
+    if (pipe2(ready_pipe, O_CLOEXEC) != 0) {
+        perror("Cannot create worker ready pipe");
+        return 4;
+    }
+    supervisor.ready_fd = ready_pipe[1];
+
+    printf("[master %i] Starting %d worker(s)\n", getpid(), num_workers);
+    for (int i = 0; i < num_workers; ++i) {
+        if (spawn_worker(&supervisor, &workers[i]) != 0) {
+            perror("Cannot fork processes");
+            stop_workers(workers, num_workers);
+            return 4;
+        }
+    }
+    int num_ready = wait_for_workers(&supervisor, ready_pipe[0], num_workers);
+    printf("[master %i] %d of %d worker(s) ready\n", getpid(), num_ready, num_workers);
+    fflush(stdout);
+    // If we are an upgrade, the previous generation can start draining once
+    // all of ours serve. Otherwise we step aside: exiting closes the channel
+    // and the previous generation keeps serving.
+    if (upgrade_pending() && num_ready < num_workers) {
+        fprintf(stderr, "[master %i] Only %d of %d worker(s) ready, leaving the previous generation serving\n",
+            getpid(), num_ready, num_workers);
+        stop_workers(workers, num_workers);
+        return 4;
+    }
+    upgrade_ready();
+
+    bool retiring = false;
+    while (true) {
+        int64_t next_respawn = -1;
+        for (int i = 0; i < num_workers; ++i) {
+            if (workers[i].pid == 0 && workers[i].respawn_at >= 0
+                && (next_respawn < 0 || workers[i].respawn_at < next_respawn)) {
+                next_respawn = workers[i].respawn_at;
+            }
+        }
+        int signal_number;
+        if (next_respawn < 0) {
+            signal_number = sigwaitinfo(&master_signals, NULL);
+        } else {
+            int64_t wait_ms = next_respawn - now();
+            if (wait_ms < 0) {
+                wait_ms = 0;
+            }
+            struct timespec timeout = {wait_ms / 1000, (wait_ms % 1000) * 1000000};
+            signal_number = sigtimedwait(&master_signals, NULL, &timeout);
+        }
+
+        switch (signal_number) {
+            case SIGCHLD:
+                if (reap_workers(workers, num_workers, retiring) == 0 && retiring) {
+                    printf("[master %i] All workers drained\n", getpid());
+                    return 0;
+                }
+                break;
+            case SIGUSR1:
+                print_workers(workers, num_workers);
+                break;
+            case SIGUSR2: {
+                if (retiring) {
+                    break;
+                }
+                printf("[master %i] Starting new generation\n", getpid());
+                pid_t successor = upgrade_start(options->args, listeners, num_listeners);
+                if (successor < 0) {
+                    fprintf(stderr, "[master %i] New generation failed to start, keeping this one\n", getpid());
+                    break;
+                }
+                printf("[master %i] New generation (master %i) is serving, draining workers\n", getpid(), successor);
+                retiring = true;
+                retire_workers(workers, num_workers);
+                break;
+            }
+            case SIGQUIT:
+                printf("[master %i] Draining workers\n", getpid());
+                retiring = true;
+                retire_workers(workers, num_workers);
+                break;
+            case SIGTERM:
+            case SIGINT:
+                printf("[master %i] Stopping workers\n", getpid());
+                stop_workers(workers, num_workers);
+                return 0;
+            default:
+                break;
+        }
+        fflush(stdout);
+        if (retiring) {
+            // Also covers workers that were already gone when we started.
+            if (reap_workers(workers, num_workers, retiring) == 0) {
+                printf("[master %i] All workers drained\n", getpid());
+                return 0;
+            }
+            continue;
+        }
+
+        int64_t current_time = now();
+        for (int i = 0; i < num_workers; ++i) {
+            BLASTER_WORKER *worker = &workers[i];
+            if (worker->pid != 0 || worker->respawn_at > current_time) {
+                continue;
+            }
+            if (spawn_worker(&supervisor, worker) != 0) {
+                perror("Cannot respawn worker");
+                worker->respawn_at = current_time + worker->backoff_ms;
+                continue;
+            }
+            worker->restarts++;
+        }
+    }
+}
@@ -0,0 +1,134 @@
+#include <libmill.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <blaster/timer_wheel.h>
+
+typedef struct BLASTER_TIMER_WHEEL {
+    // Slot heads: circular lists with the head as sentinel, so a timer can
+    // unlink itself without knowing where it is.
+    BLASTER_TIMER slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    // The next tick to process
+    uint64_t next_tick;
+    bool running;
+} BLASTER_TIMER_WHEEL;
+
+// Per thread, like the scheduler whose connections it times.
+static _Thread_local BLASTER_TIMER_WHEEL wheel;
+
+static uint64_t current_tick(void) {
+    return (uint64_t)now() / TIMER_WHEEL_TICK_MS;
+}
+
+static void unlink_timer(BLASTER_TIMER *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+// Puts timer in the slot that will be processed (or cascaded) on its tick.
+static void place_timer(BLASTER_TIMER *timer) {
+    uint64_t expires = timer->expires_tick;
+    if (expires < wheel.next_tick) {
+        expires = wheel.next_tick;
+    }
+    uint64_t delta = expires - wheel.next_tick;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    uint64_t span = 1ULL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS);
+    if (delta >= span) {
+        // Beyond the wheel: park it at the far end and let it cascade back.
+        expires = wheel.next_tick + span - 1;
+    }
+    BLASTER_TIMER *head = &wheel.slots[level][(expires >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+// Re-places every timer of a higher level slot, which lands them lower.
+static void cascade(int level, int slot) {
+    BLASTER_TIMER *head = &wheel.slots[level][slot];
+    BLASTER_TIMER pending = {.next = &pending, .prev = &pending};
+    if (head->next != head) {
+        // Move the whole list aside first; place_timer() may put timers
+        // straight back into this slot.
+        pending.next = head->next;
+        pending.prev = head->prev;
+        pending.next->prev = &pending;
+        pending.prev->next = &pending;
+        head->next = head;
+        head->prev = head;
+    }
+    while (pending.next != &pending) {
+        BLASTER_TIMER *timer = pending.next;
+        unlink_timer(timer);
+        place_timer(timer);
+    }
+}
+
+static void process_tick(uint64_t tick) {
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+        // Level N's slot comes due when every level below has wrapped around.
+        if ((tick & ((1ULL << (TIMER_WHEEL_SLOT_BITS * level)) - 1)) != 0) {
+            break;
+        }
+        cascade(level, (tick >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOTS - 1));
+    }
+    BLASTER_TIMER *head = &wheel.slots[0][tick & (TIMER_WHEEL_SLOTS - 1)];
+    while (head->next != head) {
+        BLASTER_TIMER *timer = head->next;
+        unlink_timer(timer);
+        timer->expired = true;
+        // Wakes whoever waits on the fd; they see EOF or EPIPE and close.
+        shutdown(timer->fd, SHUT_RDWR);
+    }
+}
+
+static coroutine void timer_wheel_run(void) {
+    for (;;) {
+        msleep(now() + TIMER_WHEEL_TICK_MS);
+        uint64_t tick = current_tick();
+        while (wheel.next_tick <= tick) {
+            process_tick(wheel.next_tick);
+            wheel.next_tick++;
+        }
+    }
+}
+
+void timer_wheel_init(void) {
+    if (wheel.running) {
+        return;
+    }
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot) {
+            wheel.slots[level][slot].next = &wheel.slots[level][slot];
+            wheel.slots[level][slot].prev = &wheel.slots[level][slot];
+        }
+    }
+    wheel.next_tick = current_tick();
+    wheel.running = true;
+    go(timer_wheel_run());
+}
+
+void timer_arm(BLASTER_TIMER *timer, int fd, int64_t timeout_ms) {
+    timer_cancel(timer);
+    if (timeout_ms <= 0) {
+        return;
+    }
+    timer->fd = fd;
+    timer->expired = false;
+    // Counted from the tick we are in, so a timeout can fire up to a tick
+    // late but never early.
+    timer->expires_tick = wheel.next_tick + (uint64_t)((timeout_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS);
+    place_timer(timer);
+}
+
+void timer_cancel(BLASTER_TIMER *timer) {
+    if (timer->next != NULL) {
+        unlink_timer(timer);
+    }
+}
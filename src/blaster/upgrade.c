@@ -0,0 +1,186 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <blaster/upgrade.h>
+
+// The kernel refuses more than SCM_MAX_FD (253) descriptors per message.
+#define UPGRADE_FDS_PER_MESSAGE 250
+#define UPGRADE_READY_BYTE 'R'
+
+// Our end of the channel to the previous generation, while we owe it a
+// ready notification.
+static int upgrade_channel = -1;
+
+static int send_listeners(int channel, const int listeners[], int num_listeners) {
+    int sent = 0;
+    while (sent < num_listeners) {
+        int count = num_listeners - sent;
+        if (count > UPGRADE_FDS_PER_MESSAGE) {
+            count = UPGRADE_FDS_PER_MESSAGE;
+        }
+        // total, then how many ride along with this message
+        int header[2] = {num_listeners, count};
+        struct iovec iov = {.iov_base = header, .iov_len = sizeof(header)};
+        char control[CMSG_SPACE(sizeof(int) * UPGRADE_FDS_PER_MESSAGE)];
+        memset(control, 0, sizeof(control));
+        struct msghdr message = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control,
+            .msg_controllen = CMSG_SPACE(sizeof(int) * count),
+        };
+        struct cmsghdr *control_message = CMSG_FIRSTHDR(&message);
+        control_message->cmsg_level = SOL_SOCKET;
+        control_message->cmsg_type = SCM_RIGHTS;
+        control_message->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(control_message), listeners + sent, sizeof(int) * count);
+        if (sendmsg(channel, &message, MSG_NOSIGNAL) != (ssize_t)sizeof(header)) {
+            return -1;
+        }
+        sent += count;
+    }
+    return 0;
+}
+
+static int receive_listeners(int channel, int listeners[], int num_listeners) {
+    int received = 0;
+    while (received < num_listeners) {
+        int header[2];
+        struct iovec iov = {.iov_base = header, .iov_len = sizeof(header)};
+        char control[CMSG_SPACE(sizeof(int) * UPGRADE_FDS_PER_MESSAGE)];
+        struct msghdr message = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+        };
+        if (recvmsg(channel, &message, MSG_CMSG_CLOEXEC) != (ssize_t)sizeof(header)) {
+            goto error;
+        }
+        struct cmsghdr *control_message = CMSG_FIRSTHDR(&message);
+        if (control_message == NULL || control_message->cmsg_type != SCM_RIGHTS) {
+            goto error;
+        }
+        int count = (control_message->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int fds[UPGRADE_FDS_PER_MESSAGE];
+        memcpy(fds, CMSG_DATA(control_message), sizeof(int) * count);
+        if (header[0] != num_listeners || count != header[1] || received + count > num_listeners) {
+            fprintf(stderr, "Previous generation has %d listener(s), we need %d\n", header[0], num_listeners);
+            for (int i = 0; i < count; ++i) {
+                close(fds[i]);
+            }
+            goto error;
+        }
+        memcpy(listeners + received, fds, sizeof(int) * count);
+        received += count;
+    }
+    return 0;
+    error:
+        for (int i = 0; i < received; ++i) {
+            close(listeners[i]);
+        }
+        return -1;
+}
+
+int upgrade_inherit_listeners(int listeners[], int num_listeners) {
+    const char *value = getenv(UPGRADE_FD_ENV);
+    if (value == NULL) {
+        return 0;
+    }
+    int channel = atoi(value);
+    // Our own workers and any later generation must not see it.
+    unsetenv(UPGRADE_FD_ENV);
+    fcntl(channel, F_SETFD, FD_CLOEXEC);
+    if (receive_listeners(channel, listeners, num_listeners) != 0) {
+        close(channel);
+        return -1;
+    }
+    upgrade_channel = channel;
+    return 1;
+}
+
+bool upgrade_pending(void) {
+    return upgrade_channel >= 0;
+}
+
+void upgrade_ready(void) {
+    if (upgrade_channel < 0) {
+        return;
+    }
+    char ready = UPGRADE_READY_BYTE;
+    if (send(upgrade_channel, &ready, sizeof(ready), MSG_NOSIGNAL) != sizeof(ready)) {
+        perror("Cannot tell the previous generation we are ready");
+    }
+    close(upgrade_channel);
+    upgrade_channel = -1;
+}
+
+pid_t upgrade_start(char *const args[], const int listeners[], int num_listeners) {
+    int channel[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, channel) != 0) {
+        return -1;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(channel[0]);
+        close(channel[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        // The new generation's end has to survive the exec.
+        fcntl(channel[1], F_SETFD, 0);
+        char value[16];
+        snprintf(value, sizeof(value), "%d", channel[1]);
+        setenv(UPGRADE_FD_ENV, value, 1);
+        sigset_t no_signals;
+        sigemptyset(&no_signals);
+        sigprocmask(SIG_SETMASK, &no_signals, NULL);
+        execvp(args[0], args);
+        perror("Cannot exec the new generation");
+        _exit(127);
+    }
+    close(channel[1]);
+
+    char ready = 0;
+    struct pollfd wait_for = {.fd = channel[0], .events = POLLIN};
+    if (send_listeners(channel[0], listeners, num_listeners) != 0) {
+        goto error;
+    }
+    int polled;
+    do {
+        polled = poll(&wait_for, 1, UPGRADE_READY_TIMEOUT_MS);
+    } while (polled < 0 && errno == EINTR);
+    if (polled != 1 || read(channel[0], &ready, sizeof(ready)) != sizeof(ready) || ready != UPGRADE_READY_BYTE) {
+        goto error;
+    }
+    close(channel[0]);
+    return pid;
+    error:
+        kill(pid, SIGTERM);
+        close(channel[0]);
+        return -1;
+}
+
+static void on_refused_upgrade(int signal_number) {
+    (void)signal_number;
+    static const char message[] = "Ignoring SIGUSR2: upgrading without downtime needs --supervise\n";
+    ssize_t written = write(STDERR_FILENO, message, sizeof(message) - 1);
+    (void)written;
+}
+
+void upgrade_refuse(void) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_refused_upgrade;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR2, &action, NULL);
+}
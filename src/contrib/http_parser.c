@@ -60,6 +60,7 @@ do {                                                                 \
 #define UPDATE_STATE(V) p_state = (enum state) (V);
 #define RETURN(V)                                                    \
 do {                                                                 \
+  FLUSH_HEADER_SIZE(data + (V));                                     \
   parser->state = CURRENT_STATE();                                   \
   return (V);                                                        \
 } while (0);
@@ -90,6 +91,7 @@ do {                                                                 \
                                                                      \
     /* We either errored above or got paused; get out */             \
     if (UNLIKELY(HTTP_PARSER_ERRNO(parser) != HPE_OK)) {             \
+      FLUSH_HEADER_SIZE(data + (ER));                                \
       return (ER);                                                   \
     }                                                                \
   }                                                                  \
@@ -117,6 +119,7 @@ do {                                                                 \
                                                                      \
       /* We either errored above or got paused; get out */           \
       if (UNLIKELY(HTTP_PARSER_ERRNO(parser) != HPE_OK)) {           \
+        FLUSH_HEADER_SIZE(data + (ER));                              \
         return (ER);                                                 \
       }                                                              \
     }                                                                \
@@ -141,20 +144,35 @@ do {                                                                 \
 } while (0)
 
 /* Don't allow the total size of the HTTP headers (including the status
- * line) to exceed HTTP_MAX_HEADER_SIZE.  This check is here to protect
- * embedders against denial-of-service attacks where the attacker feeds
- * us a never-ending header that the embedder keeps buffering.
+ * line) to exceed the parser's max_header_size (HTTP_MAX_HEADER_SIZE unless
+ * set with http_parser_set_max_header_size()).  This check is here to
+ * protect embedders against denial-of-service attacks where the attacker
+ * feeds us a never-ending header that the embedder keeps buffering.
  *
  * This check is arguably the responsibility of embedders but we're doing
  * it on the embedder's behalf because most won't bother and this way we
  * make the web a little safer.  HTTP_MAX_HEADER_SIZE is still far bigger
  * than any reasonable request or response so this should never affect
  * day-to-day operation.
+ *
+ * Header bytes are not counted one at a time. header_size_mark points at
+ * the first header byte of this buffer that has not been added to nread yet
+ * (NULL outside the header states), and the span up to a point is counted
+ * at the end of each header name, value and URL run, before nread is reset
+ * between messages and chunks, and when we return.
  */
-#define COUNT_HEADER_SIZE(V)                                         \
+#define FLUSH_HEADER_SIZE(END)                                       \
 do {                                                                 \
-  parser->nread += (V);                                              \
-  if (UNLIKELY(parser->nread > (HTTP_MAX_HEADER_SIZE))) {            \
+  if (header_size_mark != NULL && (END) > header_size_mark) {        \
+    parser->nread += (uint32_t) ((END) - header_size_mark);          \
+    header_size_mark = (END);                                        \
+  }                                                                  \
+} while (0)
+
+#define COUNT_HEADER_SIZE(END)                                       \
+do {                                                                 \
+  FLUSH_HEADER_SIZE(END);                                            \
+  if (UNLIKELY(parser->nread > max_header_size)) {                   \
     SET_ERRNO(HPE_HEADER_OVERFLOW);                                  \
     goto error;                                                      \
   }                                                                  \
@@ -178,6 +196,137 @@ static const char *method_strings[] =
 #undef XX
   };
 
+static const uint8_t method_lengths[] =
+  {
+#define XX(num, name, string) sizeof(#string) - 1,
+  HTTP_METHOD_MAP(XX)
+#undef XX
+  };
+
+/* Longest entry in method_strings */
+#define METHOD_MAX_LENGTH (sizeof("UNSUBSCRIBE") - 1)
+
+
+/* Method recognition.
+ *
+ * A method that arrives whole in one read is looked up in a single step:
+ * GET, POST and HEAD are compared outright, anything else goes through a
+ * perfect hash of its length, first byte and last two bytes, and the one
+ * candidate that comes out is compared in full. The multiplier was picked
+ * offline so that no two methods share a slot; the table itself is filled
+ * in at load time from method_strings, and a slot two methods did land in
+ * would be left empty, costing them the slow path but never a match.
+ *
+ * A method split across reads is matched a byte at a time instead:
+ * parser->method is some method whose first parser->index bytes are the
+ * ones seen so far, and http_method_extend() swaps it for one that also
+ * has the next byte.
+ */
+#define METHOD_HASH_BITS 6
+#define METHOD_HASH_MULTIPLIER 0x2e7fc5f7u
+#define METHOD_SLOT_EMPTY 0xff
+#define METHOD_SLOT_SHARED 0xfe
+
+static uint8_t http_method_table[1 << METHOD_HASH_BITS];
+
+static unsigned int
+http_method_hash(const char *token, size_t length)
+{
+  uint32_t key = (uint32_t) (unsigned char) token[0]
+               | (uint32_t) (unsigned char) token[length - 2] << 8
+               | (uint32_t) (unsigned char) token[length - 1] << 16
+               | (uint32_t) length << 24;
+
+  return (uint32_t) (key * METHOD_HASH_MULTIPLIER) >> (32 - METHOD_HASH_BITS);
+}
+
+#ifdef __GNUC__
+__attribute__((constructor))
+#endif
+static void
+http_method_init(void)
+{
+  unsigned int m, slot;
+
+  memset(http_method_table, METHOD_SLOT_EMPTY, sizeof(http_method_table));
+  for (m = 0; m < ARRAY_SIZE(method_strings); m++) {
+    if (method_lengths[m] > METHOD_MAX_LENGTH) {
+      continue;  /* never looked up whole, http_method_extend() finds it */
+    }
+    slot = http_method_hash(method_strings[m], method_lengths[m]);
+    http_method_table[slot] = http_method_table[slot] == METHOD_SLOT_EMPTY
+                            ? (uint8_t) m : METHOD_SLOT_SHARED;
+  }
+  for (slot = 0; slot < ARRAY_SIZE(http_method_table); slot++) {
+    if (http_method_table[slot] == METHOD_SLOT_SHARED) {
+      http_method_table[slot] = METHOD_SLOT_EMPTY;
+    }
+  }
+}
+
+/* Looks for a whole method followed by a space at the start of [p, end).
+ * Returns a pointer to the space and sets *method, or NULL if there is no
+ * such method or it runs past end.
+ */
+static const char *
+http_method_match(const char *p, const char *end, int *method)
+{
+  const char *space;
+  unsigned int slot;
+  size_t length;
+
+  if (LIKELY(end - p >= 5)) {
+    if (memcmp(p, "GET ", 4) == 0) {
+      *method = HTTP_GET;
+      return p + 3;
+    }
+    if (memcmp(p, "POST ", 5) == 0) {
+      *method = HTTP_POST;
+      return p + 4;
+    }
+    if (memcmp(p, "HEAD ", 5) == 0) {
+      *method = HTTP_HEAD;
+      return p + 4;
+    }
+  }
+
+  length = MIN((size_t) (end - p), METHOD_MAX_LENGTH + 1);
+  space = (const char *) memchr(p, ' ', length);
+  if (space == NULL || space - p < 3) {
+    return NULL;
+  }
+  length = space - p;
+  slot = http_method_table[http_method_hash(p, length)];
+  if (slot == METHOD_SLOT_EMPTY || method_lengths[slot] != length ||
+      memcmp(method_strings[slot], p, length) != 0) {
+    return NULL;
+  }
+  *method = slot;
+  return space;
+}
+
+/* A method whose first index bytes are those of method and whose next one
+ * is ch ('\0' to end it there), or -1 if there is none.
+ */
+static int
+http_method_extend(unsigned int method, unsigned int index, char ch)
+{
+  const char *matcher = method_strings[method];
+  unsigned int m;
+
+  if (LIKELY(matcher[index] == ch)) {
+    return method;
+  }
+  for (m = 0; m < ARRAY_SIZE(method_strings); m++) {
+    if (method_lengths[m] >= index &&
+        method_strings[m][index] == ch &&
+        memcmp(method_strings[m], matcher, index) == 0) {
+      return m;
+    }
+  }
+  return -1;
+}
+
 
 /* Tokens as defined by rfc 2616. Also lowercases them.
  *        token       = 1*<any CHAR except CTLs or separators>
@@ -440,9 +589,13 @@ enum http_host_state
  * character or %x80-FF
  **/
 #define IS_HEADER_CHAR(ch)                                                     \
-  (ch == CR || ch == LF || ch == 9 || (ch > 31 && ch != 127))
+  (ch == CR || ch == LF || ch == 9 || ((unsigned char)ch > 31 && ch != 127))
 
+#if HTTP_PARSER_REQUEST_ONLY
+#define start_state s_start_req
+#else
 #define start_state (parser->type == HTTP_REQUEST ? s_start_req : s_start_res)
+#endif
 
 
 #if HTTP_PARSER_STRICT
@@ -631,6 +784,242 @@ parse_url_char(enum state s, const char ch)
   return s_dead;
 }
 
+/* Run scanning.
+ *
+ * Most of a request is long runs of bytes that leave the parser state alone:
+ * header names, header values, paths and query strings. http_scan() skips
+ * such a run in one call and returns a pointer to the first byte that ends
+ * it (or `end`), so http_parser_execute() only walks the byte that actually
+ * changes state.
+ *
+ * The set of bytes that continues each run is derived once, at load time,
+ * from the same predicates the byte-at-a-time code uses, so a kernel can
+ * never disagree with the switch it is short-cutting. Every set is either
+ * closed or open over all of 0x80-0xFF, which lets the vector kernels
+ * classify the low 7 bits with two nibble lookups (pshufb) and the high bit
+ * with a single movemask.
+ *
+ * The kernel is picked at load time from what the CPU supports; set
+ * HTTP_PARSER_SCAN=scalar|sse4.2|avx2 in the environment to force one.
+ */
+enum http_scan_class
+  { SCAN_HEADER_FIELD
+  , SCAN_HEADER_VALUE
+  , SCAN_URL_PATH
+  , SCAN_URL_QUERY
+  , SCAN_URL_FRAGMENT
+  , SCAN_CLASSES
+  };
+
+typedef const char *(*http_scan_fn)(enum http_scan_class cls,
+                                    const char *p,
+                                    const char *end);
+
+static struct {
+  uint8_t run[32];          /* bitmap over 0-255, 1 = byte continues the run */
+  uint8_t low_nibble[16];   /* bit h set when (h << 4 | n) continues the run */
+  uint8_t high_nibble[16];  /* 1 << h for h < 8, 0 for the 0x80-0xFF rows */
+  int high_bytes_run;       /* all of 0x80-0xFF continue the run */
+} http_scan_classes[SCAN_CLASSES];
+
+static int
+http_scan_member(enum http_scan_class cls, const char ch)
+{
+  switch (cls) {
+    case SCAN_HEADER_FIELD:
+      return TOKEN(ch) != 0;
+
+    case SCAN_HEADER_VALUE:
+      /* Stop on bytes the strict check rejects as well, so it sees every one
+       * of them however the value is split across reads. */
+      return ch != CR && ch != LF && IS_HEADER_CHAR(ch);
+
+    case SCAN_URL_PATH:
+      return parse_url_char(s_req_path, ch) == s_req_path;
+
+    case SCAN_URL_QUERY:
+      return parse_url_char(s_req_query_string, ch) == s_req_query_string;
+
+    case SCAN_URL_FRAGMENT:
+      return parse_url_char(s_req_fragment, ch) == s_req_fragment;
+
+    default:
+      return 0;
+  }
+}
+
+static const char *
+http_scan_scalar(enum http_scan_class cls, const char *p, const char *end)
+{
+  const uint8_t *run = http_scan_classes[cls].run;
+
+  while (p != end && BIT_AT(run, (unsigned char) *p)) {
+    p++;
+  }
+
+  return p;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HTTP_SCAN_X86 1
+#include <immintrin.h>
+
+__attribute__((target("sse4.2")))
+static const char *
+http_scan_sse42(enum http_scan_class cls, const char *p, const char *end)
+{
+  const __m128i low_nibble =
+    _mm_loadu_si128((const __m128i *) http_scan_classes[cls].low_nibble);
+  const __m128i high_nibble =
+    _mm_loadu_si128((const __m128i *) http_scan_classes[cls].high_nibble);
+  const __m128i nibble_mask = _mm_set1_epi8(0x0f);
+  const int high_bytes_run = http_scan_classes[cls].high_bytes_run;
+
+  while (end - p >= 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *) p);
+    __m128i low = _mm_shuffle_epi8(low_nibble,
+                                   _mm_and_si128(bytes, nibble_mask));
+    __m128i high = _mm_shuffle_epi8(high_nibble,
+                                    _mm_and_si128(_mm_srli_epi16(bytes, 4),
+                                                  nibble_mask));
+    __m128i outside = _mm_cmpeq_epi8(_mm_and_si128(low, high),
+                                     _mm_setzero_si128());
+    unsigned int stops = (unsigned int) _mm_movemask_epi8(outside);
+
+    if (high_bytes_run) {
+      stops &= ~(unsigned int) _mm_movemask_epi8(bytes);
+    }
+
+    if (stops) {
+      return p + __builtin_ctz(stops);
+    }
+
+    p += 16;
+  }
+
+  return http_scan_scalar(cls, p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *
+http_scan_avx2(enum http_scan_class cls, const char *p, const char *end)
+{
+  if (end - p < 32) {
+    return http_scan_sse42(cls, p, end);
+  }
+
+  const __m256i low_nibble = _mm256_broadcastsi128_si256(
+    _mm_loadu_si128((const __m128i *) http_scan_classes[cls].low_nibble));
+  const __m256i high_nibble = _mm256_broadcastsi128_si256(
+    _mm_loadu_si128((const __m128i *) http_scan_classes[cls].high_nibble));
+  const __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+  const int high_bytes_run = http_scan_classes[cls].high_bytes_run;
+
+  while (end - p >= 32) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i *) p);
+    __m256i low = _mm256_shuffle_epi8(low_nibble,
+                                      _mm256_and_si256(bytes, nibble_mask));
+    __m256i high = _mm256_shuffle_epi8(high_nibble,
+                                       _mm256_and_si256(
+                                         _mm256_srli_epi16(bytes, 4),
+                                         nibble_mask));
+    __m256i outside = _mm256_cmpeq_epi8(_mm256_and_si256(low, high),
+                                        _mm256_setzero_si256());
+    unsigned int stops = (unsigned int) _mm256_movemask_epi8(outside);
+
+    if (high_bytes_run) {
+      stops &= ~(unsigned int) _mm256_movemask_epi8(bytes);
+    }
+
+    if (stops) {
+      return p + __builtin_ctz(stops);
+    }
+
+    p += 32;
+  }
+
+  /* The SSE kernel is not VEX encoded; clear the upper halves first or
+   * every legacy SSE instruction in it pays an AVX transition penalty.
+   */
+  _mm256_zeroupper();
+  return http_scan_sse42(cls, p, end);
+}
+#endif
+
+static http_scan_fn http_scan_impl = http_scan_scalar;
+
+static inline const char *
+http_scan(enum http_scan_class cls, const char *p, const char *end)
+{
+  return http_scan_impl(cls, p, end);
+}
+
+#ifdef __GNUC__
+__attribute__((constructor))
+#endif
+static void
+http_scan_init(void)
+{
+  const char *forced = getenv("HTTP_PARSER_SCAN");
+  unsigned int cls, ch;
+
+  for (cls = 0; cls < SCAN_CLASSES; cls++) {
+    memset(&http_scan_classes[cls], 0, sizeof(http_scan_classes[cls]));
+    for (ch = 0; ch < 256; ch++) {
+      if (!http_scan_member((enum http_scan_class) cls, (char) ch)) {
+        continue;
+      }
+      http_scan_classes[cls].run[ch >> 3] |= 1 << (ch & 7);
+      if (ch < 0x80) {
+        http_scan_classes[cls].low_nibble[ch & 0x0f] |= 1 << (ch >> 4);
+      }
+    }
+    for (ch = 0; ch < 8; ch++) {
+      http_scan_classes[cls].high_nibble[ch] = 1 << ch;
+    }
+    /* The vector kernels assume 0x80-0xFF are all in or all out. */
+    http_scan_classes[cls].high_bytes_run =
+      BIT_AT(http_scan_classes[cls].run, 0x80);
+    for (ch = 0x81; ch < 256; ch++) {
+      assert(BIT_AT(http_scan_classes[cls].run, ch) ==
+             http_scan_classes[cls].high_bytes_run);
+    }
+  }
+
+  http_scan_impl = http_scan_scalar;
+  if (forced != NULL && strcmp(forced, "scalar") == 0) {
+    return;
+  }
+#ifdef HTTP_SCAN_X86
+  __builtin_cpu_init();
+  if (forced != NULL && strcmp(forced, "sse4.2") == 0) {
+    if (__builtin_cpu_supports("sse4.2")) {
+      http_scan_impl = http_scan_sse42;
+    }
+    return;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    http_scan_impl = http_scan_avx2;
+  } else if (__builtin_cpu_supports("sse4.2")) {
+    http_scan_impl = http_scan_sse42;
+  }
+#endif
+}
+
+const char *
+http_parser_scan_kernel(void)
+{
+#ifdef HTTP_SCAN_X86
+  if (http_scan_impl == http_scan_avx2) {
+    return "avx2";
+  }
+  if (http_scan_impl == http_scan_sse42) {
+    return "sse4.2";
+  }
+#endif
+  return "scalar";
+}
+
 size_t http_parser_execute (http_parser *parser,
                             const http_parser_settings *settings,
                             const char *data,
@@ -644,8 +1033,15 @@ size_t http_parser_execute (http_parser *parser,
   const char *url_mark = 0;
   const char *body_mark = 0;
   const char *status_mark = 0;
+  const char *header_size_mark = 0;
   enum state p_state = (enum state) parser->state;
+#if HTTP_PARSER_LENIENT_HEADERS < 0
   const unsigned int lenient = parser->lenient_http_headers;
+#else
+  const unsigned int lenient = HTTP_PARSER_LENIENT_HEADERS;
+#endif
+  const uint32_t max_header_size =
+    parser->max_header_size ? parser->max_header_size : HTTP_MAX_HEADER_SIZE;
 
   /* We're in an error state. Don't bother doing anything. */
   if (HTTP_PARSER_ERRNO(parser) != HPE_OK) {
@@ -673,7 +1069,8 @@ size_t http_parser_execute (http_parser *parser,
     }
   }
 
-
+  if (PARSING_HEADER(CURRENT_STATE()))
+    header_size_mark = data;
   if (CURRENT_STATE() == s_header_field)
     header_field_mark = data;
   if (CURRENT_STATE() == s_header_value)
@@ -692,9 +1089,11 @@ size_t http_parser_execute (http_parser *parser,
   case s_req_fragment:
     url_mark = data;
     break;
+#if !HTTP_PARSER_REQUEST_ONLY
   case s_res_status:
     status_mark = data;
     break;
+#endif
   default:
     break;
   }
@@ -702,9 +1101,6 @@ size_t http_parser_execute (http_parser *parser,
   for (p=data; p != data + len; p++) {
     ch = *p;
 
-    if (PARSING_HEADER(CURRENT_STATE()))
-      COUNT_HEADER_SIZE(1);
-
 reexecute:
     switch (CURRENT_STATE()) {
 
@@ -718,6 +1114,7 @@ reexecute:
         SET_ERRNO(HPE_CLOSED_CONNECTION);
         goto error;
 
+#if !HTTP_PARSER_REQUEST_ONLY
       case s_start_req_or_res:
       {
         if (ch == CR || ch == LF)
@@ -950,152 +1347,61 @@ reexecute:
         STRICT_CHECK(ch != LF);
         UPDATE_STATE(s_header_field_start);
         break;
+#endif /* !HTTP_PARSER_REQUEST_ONLY */
 
       case s_start_req:
       {
+        const char *space;
+        int method;
+
         if (ch == CR || ch == LF)
           break;
         parser->flags = 0;
         parser->content_length = ULLONG_MAX;
 
-        if (UNLIKELY(!IS_ALPHA(ch))) {
-          SET_ERRNO(HPE_INVALID_METHOD);
-          goto error;
-        }
-
-        parser->method = (enum http_method) 0;
-        parser->index = 1;
-        switch (ch) {
-          case 'A': parser->method = HTTP_ACL; break;
-          case 'B': parser->method = HTTP_BIND; break;
-          case 'C': parser->method = HTTP_CONNECT; /* or COPY, CHECKOUT */ break;
-          case 'D': parser->method = HTTP_DELETE; break;
-          case 'G': parser->method = HTTP_GET; break;
-          case 'H': parser->method = HTTP_HEAD; break;
-          case 'L': parser->method = HTTP_LOCK; /* or LINK */ break;
-          case 'M': parser->method = HTTP_MKCOL; /* or MOVE, MKACTIVITY, MERGE, M-SEARCH, MKCALENDAR */ break;
-          case 'N': parser->method = HTTP_NOTIFY; break;
-          case 'O': parser->method = HTTP_OPTIONS; break;
-          case 'P': parser->method = HTTP_POST;
-            /* or PROPFIND|PROPPATCH|PUT|PATCH|PURGE */
-            break;
-          case 'R': parser->method = HTTP_REPORT; /* or REBIND */ break;
-          case 'S': parser->method = HTTP_SUBSCRIBE; /* or SEARCH */ break;
-          case 'T': parser->method = HTTP_TRACE; break;
-          case 'U': parser->method = HTTP_UNLOCK; /* or UNSUBSCRIBE, UNBIND, UNLINK */ break;
-          default:
+        space = http_method_match(p, data + len, &method);
+        if (space == NULL) {
+          method = http_method_extend(0, 0, ch);
+          if (UNLIKELY(method < 0)) {
             SET_ERRNO(HPE_INVALID_METHOD);
             goto error;
+          }
         }
+        parser->method = (enum http_method) method;
+        parser->index = 1;
         UPDATE_STATE(s_req_method);
 
         CALLBACK_NOTIFY(message_begin);
 
+        if (space != NULL) {
+          /* The whole method was here, up to and including the space. */
+          UPDATE_STATE(s_req_spaces_before_url);
+          p = space;
+        }
         break;
       }
 
       case s_req_method:
       {
-        const char *matcher;
+        int method;
         if (UNLIKELY(ch == '\0')) {
           SET_ERRNO(HPE_INVALID_METHOD);
           goto error;
         }
 
-        matcher = method_strings[parser->method];
-        if (ch == ' ' && matcher[parser->index] == '\0') {
-          UPDATE_STATE(s_req_spaces_before_url);
-        } else if (ch == matcher[parser->index]) {
-          ; /* nada */
-        } else if (parser->method == HTTP_CONNECT) {
-          if (parser->index == 1 && ch == 'H') {
-            parser->method = HTTP_CHECKOUT;
-          } else if (parser->index == 2  && ch == 'P') {
-            parser->method = HTTP_COPY;
-          } else {
-            SET_ERRNO(HPE_INVALID_METHOD);
-            goto error;
-          }
-        } else if (parser->method == HTTP_MKCOL) {
-          if (parser->index == 1 && ch == 'O') {
-            parser->method = HTTP_MOVE;
-          } else if (parser->index == 1 && ch == 'E') {
-            parser->method = HTTP_MERGE;
-          } else if (parser->index == 1 && ch == '-') {
-            parser->method = HTTP_MSEARCH;
-          } else if (parser->index == 2 && ch == 'A') {
-            parser->method = HTTP_MKACTIVITY;
-          } else if (parser->index == 3 && ch == 'A') {
-            parser->method = HTTP_MKCALENDAR;
-          } else {
-            SET_ERRNO(HPE_INVALID_METHOD);
-            goto error;
-          }
-        } else if (parser->method == HTTP_SUBSCRIBE) {
-          if (parser->index == 1 && ch == 'E') {
-            parser->method = HTTP_SEARCH;
-          } else {
-            SET_ERRNO(HPE_INVALID_METHOD);
-            goto error;
-          }
-        } else if (parser->method == HTTP_REPORT) {
-            if (parser->index == 2 && ch == 'B') {
-              parser->method = HTTP_REBIND;
-            } else {
-              SET_ERRNO(HPE_INVALID_METHOD);
-              goto error;
-            }
-        } else if (parser->index == 1) {
-          if (parser->method == HTTP_POST) {
-            if (ch == 'R') {
-              parser->method = HTTP_PROPFIND; /* or HTTP_PROPPATCH */
-            } else if (ch == 'U') {
-              parser->method = HTTP_PUT; /* or HTTP_PURGE */
-            } else if (ch == 'A') {
-              parser->method = HTTP_PATCH;
-            } else {
-              SET_ERRNO(HPE_INVALID_METHOD);
-              goto error;
-            }
-          } else if (parser->method == HTTP_LOCK) {
-            if (ch == 'I') {
-              parser->method = HTTP_LINK;
-            } else {
-              SET_ERRNO(HPE_INVALID_METHOD);
-              goto error;
-            }
-          }
-        } else if (parser->index == 2) {
-          if (parser->method == HTTP_PUT) {
-            if (ch == 'R') {
-              parser->method = HTTP_PURGE;
-            } else {
-              SET_ERRNO(HPE_INVALID_METHOD);
-              goto error;
-            }
-          } else if (parser->method == HTTP_UNLOCK) {
-            if (ch == 'S') {
-              parser->method = HTTP_UNSUBSCRIBE;
-            } else if(ch == 'B') {
-              parser->method = HTTP_UNBIND;
-            } else {
-              SET_ERRNO(HPE_INVALID_METHOD);
-              goto error;
-            }
-          } else {
-            SET_ERRNO(HPE_INVALID_METHOD);
-            goto error;
-          }
-        } else if (parser->index == 4 && parser->method == HTTP_PROPFIND && ch == 'P') {
-          parser->method = HTTP_PROPPATCH;
-        } else if (parser->index == 3 && parser->method == HTTP_UNLOCK && ch == 'I') {
-          parser->method = HTTP_UNLINK;
-        } else {
+        method = http_method_extend(parser->method, parser->index,
+                                    ch == ' ' ? '\0' : ch);
+        if (UNLIKELY(method < 0)) {
           SET_ERRNO(HPE_INVALID_METHOD);
           goto error;
         }
+        parser->method = (enum http_method) method;
 
-        ++parser->index;
+        if (ch == ' ') {
+          UPDATE_STATE(s_req_spaces_before_url);
+        } else {
+          ++parser->index;
+        }
         break;
       }
 
@@ -1169,6 +1475,28 @@ reexecute:
               goto error;
             }
         }
+
+        /* Skip the rest of a path, query or fragment run in one go. */
+        {
+          const char* run_end = p + 1;
+          switch (CURRENT_STATE()) {
+            case s_req_path:
+              run_end = http_scan(SCAN_URL_PATH, p + 1, data + len);
+              break;
+            case s_req_query_string:
+              run_end = http_scan(SCAN_URL_QUERY, p + 1, data + len);
+              break;
+            case s_req_fragment:
+              run_end = http_scan(SCAN_URL_FRAGMENT, p + 1, data + len);
+              break;
+            default:
+              break;
+          }
+          if (run_end != p + 1) {
+            COUNT_HEADER_SIZE(run_end);
+            p = run_end - 1;
+          }
+        }
         break;
       }
 
@@ -1346,8 +1674,14 @@ reexecute:
 
       case s_header_field:
       {
-        const char* start = p;
         for (; p != data + len; p++) {
+          if (parser->header_state == h_general) {
+            /* Nothing left to match, skip to the end of the name. */
+            p = http_scan(SCAN_HEADER_FIELD, p, data + len);
+            if (p == data + len)
+              break;
+          }
+
           ch = *p;
           c = TOKEN(ch);
 
@@ -1461,7 +1795,7 @@ reexecute:
           }
         }
 
-        COUNT_HEADER_SIZE(p - start);
+        COUNT_HEADER_SIZE(p);
 
         if (p == data + len) {
           --p;
@@ -1553,7 +1887,6 @@ reexecute:
 
       case s_header_value:
       {
-        const char* start = p;
         enum header_states h_state = (enum header_states) parser->header_state;
         for (; p != data + len; p++) {
           ch = *p;
@@ -1566,7 +1899,7 @@ reexecute:
 
           if (ch == LF) {
             UPDATE_STATE(s_header_almost_done);
-            COUNT_HEADER_SIZE(p - start);
+            COUNT_HEADER_SIZE(p);
             parser->header_state = h_state;
             CALLBACK_DATA_NOADVANCE(header_value);
             REEXECUTE();
@@ -1582,24 +1915,11 @@ reexecute:
           switch (h_state) {
             case h_general:
             {
-              const char* p_cr;
-              const char* p_lf;
               size_t limit = data + len - p;
 
-              limit = MIN(limit, HTTP_MAX_HEADER_SIZE);
-
-              p_cr = (const char*) memchr(p, CR, limit);
-              p_lf = (const char*) memchr(p, LF, limit);
-              if (p_cr != NULL) {
-                if (p_lf != NULL && p_cr >= p_lf)
-                  p = p_lf;
-                else
-                  p = p_cr;
-              } else if (UNLIKELY(p_lf != NULL)) {
-                p = p_lf;
-              } else {
-                p = data + len;
-              }
+              limit = MIN(limit, max_header_size);
+
+              p = http_scan(SCAN_HEADER_VALUE, p + 1, p + limit);
               --p;
 
               break;
@@ -1735,7 +2055,7 @@ reexecute:
         }
         parser->header_state = h_state;
 
-        COUNT_HEADER_SIZE(p - start);
+        COUNT_HEADER_SIZE(p);
 
         if (p == data + len)
           --p;
@@ -1883,7 +2203,9 @@ reexecute:
         int hasBody;
         STRICT_CHECK(ch != LF);
 
+        COUNT_HEADER_SIZE(p + 1);
         parser->nread = 0;
+        header_size_mark = NULL;
 
         hasBody = parser->flags & F_CHUNKED ||
           (parser->content_length > 0 && parser->content_length != ULLONG_MAX);
@@ -1921,6 +2243,8 @@ reexecute:
           }
         }
 
+        if (PARSING_HEADER(CURRENT_STATE()))
+          header_size_mark = p + 1;
         break;
       }
 
@@ -1968,8 +2292,11 @@ reexecute:
         break;
 
       case s_message_done:
+        /* the end of the trailers, if there were any */
+        COUNT_HEADER_SIZE(p + 1);
         UPDATE_STATE(NEW_MESSAGE());
         CALLBACK_NOTIFY(message_complete);
+        header_size_mark = p + 1;
         if (parser->upgrade) {
           /* Exit, the rest of the message is in a different protocol. */
           RETURN((p - data) + 1);
@@ -1978,7 +2305,7 @@ reexecute:
 
       case s_chunk_size_start:
       {
-        assert(parser->nread == 1);
+        assert(parser->nread == 0);
         assert(parser->flags & F_CHUNKED);
 
         unhex_val = unhex[(unsigned char)ch];
@@ -2045,13 +2372,16 @@ reexecute:
         assert(parser->flags & F_CHUNKED);
         STRICT_CHECK(ch != LF);
 
+        COUNT_HEADER_SIZE(p + 1);
         parser->nread = 0;
 
         if (parser->content_length == 0) {
           parser->flags |= F_TRAILING;
           UPDATE_STATE(s_header_field_start);
+          header_size_mark = p + 1;
         } else {
           UPDATE_STATE(s_chunk_data);
+          header_size_mark = NULL;
         }
         CALLBACK_NOTIFY(chunk_header);
         break;
@@ -2092,6 +2422,7 @@ reexecute:
         assert(parser->flags & F_CHUNKED);
         STRICT_CHECK(ch != LF);
         parser->nread = 0;
+        header_size_mark = p + 1;
         UPDATE_STATE(s_chunk_size_start);
         CALLBACK_NOTIFY(chunk_complete);
         break;
@@ -2119,6 +2450,8 @@ reexecute:
           (body_mark ? 1 : 0) +
           (status_mark ? 1 : 0)) <= 1);
 
+  COUNT_HEADER_SIZE(data + len);
+
   CALLBACK_DATA_NOADVANCE(header_field);
   CALLBACK_DATA_NOADVANCE(header_value);
   CALLBACK_DATA_NOADVANCE(url);
@@ -2132,6 +2465,15 @@ error:
     SET_ERRNO(HPE_UNKNOWN);
   }
 
+  /* Counted byte by byte, a header span that is already over the limit
+   * would have overflowed before getting to this error, and would have in
+   * any read that ended inside it. */
+  if (header_size_mark != NULL && p >= header_size_mark &&
+      HTTP_PARSER_ERRNO(parser) != HPE_HEADER_OVERFLOW &&
+      parser->nread + (uint64_t) (p + 1 - header_size_mark) > max_header_size) {
+    SET_ERRNO(HPE_HEADER_OVERFLOW);
+  }
+
   RETURN(p - data);
 }
 
@@ -2140,6 +2482,10 @@ error:
 int
 http_message_needs_eof (const http_parser *parser)
 {
+#if HTTP_PARSER_REQUEST_ONLY
+  (void) parser;
+  return 0;
+#else
   if (parser->type == HTTP_REQUEST) {
     return 0;
   }
@@ -2157,6 +2503,7 @@ http_message_needs_eof (const http_parser *parser)
   }
 
   return 1;
+#endif
 }
 
 
@@ -2193,8 +2540,31 @@ http_parser_init (http_parser *parser, enum http_parser_type t)
   memset(parser, 0, sizeof(*parser));
   parser->data = data;
   parser->type = t;
+#if HTTP_PARSER_REQUEST_ONLY
+  if (t != HTTP_REQUEST) {
+    parser->state = s_dead;
+    parser->http_errno = HPE_INVALID_INTERNAL_STATE;
+    return;
+  }
+  parser->state = s_start_req;
+#else
   parser->state = (t == HTTP_REQUEST ? s_start_req : (t == HTTP_RESPONSE ? s_start_res : s_start_req_or_res));
+#endif
   parser->http_errno = HPE_OK;
+#ifndef __GNUC__
+  /* Without constructors the scan and method tables are built on first
+   * use. */
+  if (http_scan_classes[SCAN_HEADER_VALUE].run['a' / 8] == 0) {
+    http_scan_init();
+    http_method_init();
+  }
+#endif
+}
+
+void
+http_parser_set_max_header_size(http_parser *parser, uint32_t size)
+{
+  parser->max_header_size = size;
 }
 
 void